@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compares two bench result files and flags median regressions.
+
+    ./compare.py results-old/thread_bench.json results/thread_bench.json
+    ./compare.py --threshold=10 old.json new.json
+
+Benchmarks are matched by name and params.  Exits 1 if any median got
+slower by more than the threshold (percent, default 5).
+"""
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        doc = json.load(f)
+    results = {}
+    for r in doc["results"]:
+        params = " ".join("%s=%s" % kv for kv in sorted(r["params"].items()))
+        results[(r["name"] + " " + params).strip()] = r
+    return doc, results
+
+
+def main(argv):
+    threshold = 5.0
+    paths = []
+    for arg in argv[1:]:
+        if arg.startswith("--threshold="):
+            threshold = float(arg.split("=", 1)[1])
+        else:
+            paths.append(arg)
+    if len(paths) != 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+
+    old_doc, old = load(paths[0])
+    new_doc, new = load(paths[1])
+    print("%s: %s -> %s" % (new_doc["suite"], old_doc["commit"] or "?",
+                            new_doc["commit"] or "?"))
+    if old_doc["flags"] != new_doc["flags"]:
+        print("note: flags differ (%s vs %s)" % (old_doc["flags"],
+                                                 new_doc["flags"]))
+
+    regressions = 0
+    for key in sorted(set(old) & set(new)):
+        before = old[key]["ns_per_op"]["median"]
+        after = new[key]["ns_per_op"]["median"]
+        change = 100.0 * (after - before) / before if before else 0.0
+        mark = ""
+        if change > threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        print("%-50s %12.2f %12.2f %+8.1f%%%s" % (key, before, after, change,
+                                                  mark))
+    for key in sorted(set(old) ^ set(new)):
+        print("%-50s only in %s" % (key, paths[0] if key in old else paths[1]))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
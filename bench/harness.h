@@ -0,0 +1,350 @@
+#ifndef BENCH_HARNESS_H_
+#define BENCH_HARNESS_H_
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Shared microbenchmark harness.
+//
+// A benchmark is a function that performs its operation `iterations` times.
+// The harness doubles the iteration count during warmup until one run takes
+// at least --min-time-ms, then times --repetitions runs and reports per-op
+// statistics.  Hardware and scheduler counters are read through
+// perf_event_open(2) when the kernel allows it and left out otherwise.
+// Results go to stdout and, with --json=<file>, to a JSON file that
+// compare.py can diff against another commit's.
+//
+//   bench::Harness h("thread_bench", argc, argv);
+//   h.Run("counter/atomic", {{"threads", "4"}}, [](uint64_t n) { ... });
+//   return h.Finish();
+//
+// Benchmarks whose workload has a fixed size (a file to split, a pipeline
+// run, a server to load) time it once with Once(), which still reads the
+// counters; those that measure their own samples, such as per-call
+// latencies, hand them to Add().  Either way the result lands in the same
+// table and JSON file.  The constructor takes the harness's own options
+// out of argv and leaves the rest to the program.
+namespace bench {
+
+using Params = std::vector<std::pair<std::string, std::string>>;
+using Body = std::function<void(uint64_t iterations)>;
+
+// Keeps the compiler from discarding a computed value.
+template <typename T>
+inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct CounterSpec {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr CounterSpec kCounters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+constexpr int kNumCounters = sizeof kCounters / sizeof kCounters[0];
+
+// One perf event per counter, each inherited by threads and processes the
+// benchmark creates.  Events the kernel refuses (no PMU in a VM,
+// perf_event_paranoid) are simply absent.
+class PerfCounters {
+ public:
+  PerfCounters() {
+    for (int i = 0; i < kNumCounters; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof attr);
+      attr.size = sizeof attr;
+      attr.type = kCounters[i].type;
+      attr.config = kCounters[i].config;
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = kCounters[i].type == PERF_TYPE_HARDWARE;
+      attr.exclude_hv = 1;
+      fds_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+  }
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+  ~PerfCounters() {
+    for (int fd : fds_)
+      if (fd != -1) close(fd);
+  }
+
+  // Counts from exited children are folded into the parent event and are
+  // not cleared by PERF_EVENT_IOC_RESET, so runs are measured as the
+  // difference between two reads.
+  void Start() {
+    for (int i = 0; i < kNumCounters; i++) {
+      if (fds_[i] == -1) continue;
+      base_[i] = Read(i);
+      ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  void Stop(double values[kNumCounters]) {
+    for (int i = 0; i < kNumCounters; i++) {
+      values[i] = NAN;
+      if (fds_[i] == -1) continue;
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      values[i] = Read(i) - base_[i];
+    }
+  }
+
+ private:
+  uint64_t Read(int i) {
+    uint64_t count = 0;
+    read(fds_[i], &count, sizeof count);
+    return count;
+  }
+
+  int fds_[kNumCounters];
+  uint64_t base_[kNumCounters] = {};
+};
+
+struct Stats {
+  double min, median, mean, stddev, p90;
+};
+
+inline Stats Summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  Stats s;
+  s.min = samples[0];
+  s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+  s.p90 = samples[std::min(n - 1, static_cast<size_t>(std::ceil(0.9 * n)) - 1)];
+  double sum = 0;
+  for (double v : samples) sum += v;
+  s.mean = sum / n;
+  double var = 0;
+  for (double v : samples) var += (v - s.mean) * (v - s.mean);
+  s.stddev = n > 1 ? std::sqrt(var / (n - 1)) : 0;
+  return s;
+}
+
+class Harness {
+ public:
+  Harness(const std::string &suite, int &argc, char *argv[]) : suite_(suite) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      if (strncmp(arg, "--json=", 7) == 0)
+        json_path_ = arg + 7;
+      else if (strncmp(arg, "--filter=", 9) == 0)
+        filter_ = arg + 9;
+      else if (strncmp(arg, "--repetitions=", 14) == 0)
+        repetitions_ = std::max(1, atoi(arg + 14));
+      else if (strncmp(arg, "--min-time-ms=", 14) == 0)
+        min_time_ms_ = atof(arg + 14);
+      else
+        argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+  }
+
+  // Runs one benchmark variant unless --filter excludes it.
+  void Run(const std::string &name, const Params &params, const Body &body) {
+    std::string label = Label(name, params);
+    if (!Selected(label)) return;
+
+    // Warmup: grow the batch until it is long enough to time reliably.
+    uint64_t iterations = 1;
+    while (true) {
+      double ms = TimeMs(body, iterations);
+      if (ms >= min_time_ms_ || iterations >= (1ull << 40)) break;
+      double scale = ms > 0 ? min_time_ms_ * 1.2 / ms : 10;
+      iterations = std::max(iterations * 2,
+                            static_cast<uint64_t>(iterations *
+                                                  std::min(scale, 100.0)));
+    }
+
+    Result r;
+    r.name = name;
+    r.params = params;
+    r.iterations = iterations;
+    std::vector<double> ns_per_op;
+    std::vector<double> counter_samples[kNumCounters];
+    for (int rep = 0; rep < repetitions_; rep++) {
+      perf_.Start();
+      double ms = TimeMs(body, iterations);
+      double values[kNumCounters];
+      perf_.Stop(values);
+      ns_per_op.push_back(ms * 1e6 / iterations);
+      for (int i = 0; i < kNumCounters; i++)
+        if (!std::isnan(values[i]))
+          counter_samples[i].push_back(values[i] / iterations);
+    }
+    r.ns = Summarize(ns_per_op);
+    r.samples = repetitions_;
+    for (int i = 0; i < kNumCounters; i++)
+      r.counters[i] =
+          counter_samples[i].empty() ? NAN : Summarize(counter_samples[i]).median;
+    Print(label, r);
+  }
+
+  // Times one call of `body`, which performs `ops` operations, and
+  // returns its length in seconds (0 if --filter excludes it and it was
+  // not run).
+  double Once(const std::string &name, const Params &params, uint64_t ops,
+              const std::function<void()> &body) {
+    std::string label = Label(name, params);
+    if (!Selected(label)) return 0;
+    Result r;
+    r.name = name;
+    r.params = params;
+    r.iterations = std::max<uint64_t>(ops, 1);
+    double values[kNumCounters];
+    perf_.Start();
+    double ms = TimeMs([&body](uint64_t) { body(); }, 1);
+    perf_.Stop(values);
+    r.ns = Summarize({ms * 1e6 / r.iterations});
+    r.samples = 1;
+    for (int i = 0; i < kNumCounters; i++)
+      r.counters[i] = values[i] / r.iterations;  // NaN stays NaN
+    Print(label, r);
+    return ms / 1e3;
+  }
+
+  // Records per-op times the benchmark measured itself, e.g. one sample
+  // per call.  Counters are not available for these.
+  void Add(const std::string &name, const Params &params,
+           std::vector<double> ns_per_op) {
+    std::string label = Label(name, params);
+    if (!Selected(label) || ns_per_op.empty()) return;
+    Result r;
+    r.name = name;
+    r.params = params;
+    r.iterations = ns_per_op.size();
+    r.samples = ns_per_op.size();
+    r.ns = Summarize(std::move(ns_per_op));
+    for (double &c : r.counters) c = NAN;
+    Print(label, r);
+  }
+
+  // Writes the JSON file if one was requested.  Returns the exit status.
+  int Finish() {
+    if (json_path_.empty()) return 0;
+    FILE *out = fopen(json_path_.c_str(), "w");
+    if (out == nullptr) {
+      perror(json_path_.c_str());
+      return 1;
+    }
+    const char *commit = getenv("BENCH_COMMIT");
+    fprintf(out, "{\n  \"suite\": \"%s\",\n  \"commit\": \"%s\",\n",
+            suite_.c_str(), commit ? commit : "");
+    fprintf(out, "  \"compiler\": \"%s\",\n  \"flags\": \"%s\",\n", __VERSION__,
+#ifdef BENCH_FLAGS
+            BENCH_FLAGS
+#else
+            ""
+#endif
+    );
+    fprintf(out, "  \"repetitions\": %d,\n  \"results\": [", repetitions_);
+    for (size_t i = 0; i < results_.size(); i++) {
+      const Result &r = results_[i];
+      fprintf(out, "%s\n    {\"name\": \"%s\", \"params\": {", i ? "," : "",
+              r.name.c_str());
+      for (size_t j = 0; j < r.params.size(); j++)
+        fprintf(out, "%s\"%s\": \"%s\"", j ? ", " : "",
+                r.params[j].first.c_str(), r.params[j].second.c_str());
+      fprintf(out,
+              "}, \"iterations\": %lu, \"samples\": %zu, \"ns_per_op\": "
+              "{\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, "
+              "\"stddev\": %.3f, \"p90\": %.3f}, \"counters\": {",
+              static_cast<unsigned long>(r.iterations), r.samples, r.ns.min,
+              r.ns.median, r.ns.mean, r.ns.stddev, r.ns.p90);
+      bool first = true;
+      for (int k = 0; k < kNumCounters; k++) {
+        if (std::isnan(r.counters[k])) continue;
+        fprintf(out, "%s\"%s\": %.3f", first ? "" : ", ", kCounters[k].name,
+                r.counters[k]);
+        first = false;
+      }
+      fprintf(out, "}}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    return 0;
+  }
+
+ private:
+  struct Result {
+    std::string name;
+    Params params;
+    uint64_t iterations;
+    size_t samples;
+    Stats ns;
+    double counters[kNumCounters];
+  };
+
+  static std::string Label(const std::string &name, const Params &params) {
+    std::string label = name;
+    for (const auto &p : params) label += " " + p.first + "=" + p.second;
+    return label;
+  }
+
+  bool Selected(const std::string &label) const {
+    return filter_.empty() || label.find(filter_) != std::string::npos;
+  }
+
+  // Prints the table header before the first row, so a program's own
+  // output can come first.
+  void Print(const std::string &label, const Result &r) {
+    if (results_.empty()) {
+      printf("%-40s %12s %10s %8s", "benchmark", "median ns", "stddev %",
+             "samples");
+      for (const auto &c : kCounters) printf(" %12.12s", c.name);
+      printf("   (counters per op)\n");
+    }
+    printf("%-40s %12.2f %10.2f %8zu", label.c_str(), r.ns.median,
+           r.ns.mean > 0 ? 100 * r.ns.stddev / r.ns.mean : 0, r.samples);
+    for (double v : r.counters) {
+      if (std::isnan(v))
+        printf(" %12s", "-");
+      else
+        printf(" %12.2f", v);
+    }
+    printf("\n");
+    fflush(stdout);
+    results_.push_back(r);
+  }
+
+  static double TimeMs(const Body &body, uint64_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    body(iterations);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+  std::string suite_;
+  std::string json_path_;
+  std::string filter_;
+  int repetitions_ = 10;
+  double min_time_ms_ = 50;
+  PerfCounters perf_;
+  std::vector<Result> results_;
+};
+
+}  // namespace bench
+
+#endif  // BENCH_HARNESS_H_
@@ -0,0 +1,127 @@
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "harness.h"
+
+// Parameterised variants of the process/communication examples: one-way
+// pipe throughput at several message sizes, and parent/child ping-pong
+// latency over a pipe pair, a SysV semaphore pair and a socketpair.
+
+constexpr size_t kMessageSizes[] = {64, 4096, 65536};
+
+bool ReadFull(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n <= 0) return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool WriteFull(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buf, size);
+    if (n <= 0) return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+// The child drains `n` messages of `size` bytes from the pipe.
+void PipeThroughput(uint64_t n, size_t size) {
+  int fds[2];
+  pipe(fds);
+  std::vector<char> buf(size, 'x');
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[1]);
+    for (uint64_t i = 0; i < n; i++)
+      if (!ReadFull(fds[0], buf.data(), size)) _exit(1);
+    _exit(0);
+  }
+  close(fds[0]);
+  for (uint64_t i = 0; i < n; i++) WriteFull(fds[1], buf.data(), size);
+  close(fds[1]);
+  waitpid(pid, nullptr, 0);
+}
+
+// One byte there and back over `to_child` and `to_parent`, `n` times.
+void PingPong(uint64_t n, int to_child[2], int to_parent[2]) {
+  char byte = 0;
+  pid_t pid = fork();
+  if (pid == 0) {
+    for (uint64_t i = 0; i < n; i++) {
+      if (read(to_child[0], &byte, 1) != 1) _exit(1);
+      write(to_parent[1], &byte, 1);
+    }
+    _exit(0);
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    write(to_child[1], &byte, 1);
+    read(to_parent[0], &byte, 1);
+  }
+  waitpid(pid, nullptr, 0);
+}
+
+void Semop(int semid, unsigned short num, short op) {
+  struct sembuf sb = {num, op, 0};
+  semop(semid, &sb, 1);
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("ipc_bench", argc, argv);
+  for (int i = 1; i < argc; i++)
+    fprintf(stderr, "%s: unknown option %s\n", argv[0], argv[i]);
+
+  for (size_t size : kMessageSizes)
+    h.Run("pipe/throughput", {{"size", std::to_string(size)}},
+          [size](uint64_t n) { PipeThroughput(n, size); });
+
+  h.Run("pipe/ping_pong", {}, [](uint64_t n) {
+    int to_child[2], to_parent[2];
+    pipe(to_child);
+    pipe(to_parent);
+    PingPong(n, to_child, to_parent);
+    for (int fd : {to_child[0], to_child[1], to_parent[0], to_parent[1]})
+      close(fd);
+  });
+
+  h.Run("socketpair/ping_pong", {}, [](uint64_t n) {
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    int to_child[2] = {sv[1], sv[0]};
+    int to_parent[2] = {sv[0], sv[1]};
+    PingPong(n, to_child, to_parent);
+    close(sv[0]);
+    close(sv[1]);
+  });
+
+  // Semaphore 0 wakes the child, semaphore 1 wakes the parent.
+  h.Run("semaphore/ping_pong", {}, [](uint64_t n) {
+    int semid = semget(IPC_PRIVATE, 2, IPC_CREAT | 0600);
+    pid_t pid = fork();
+    if (pid == 0) {
+      for (uint64_t i = 0; i < n; i++) {
+        Semop(semid, 0, -1);
+        Semop(semid, 1, 1);
+      }
+      _exit(0);
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      Semop(semid, 0, 1);
+      Semop(semid, 1, -1);
+    }
+    waitpid(pid, nullptr, 0);
+    semctl(semid, 0, IPC_RMID);
+  });
+
+  return h.Finish();
+}
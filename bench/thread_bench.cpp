@@ -0,0 +1,92 @@
+#include <pthread.h>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+
+// Parameterised variants of the thread/ examples: the mutex- and
+// atomic-protected counters at several thread counts, with every thread
+// hitting one shared counter or its own cache line, plus the cost of the
+// create/join and async/get round trips the examples are built around.
+
+constexpr int kThreadCounts[] = {1, 2, 4, 8};
+
+struct alignas(64) PaddedMutexCounter {
+  std::mutex mutex;
+  long value = 0;
+};
+
+struct alignas(64) PaddedAtomicCounter {
+  std::atomic<long> value{0};
+};
+
+// Splits `iterations` increments across `threads` threads, each running
+// `work(thread_index, count)`.
+template <typename Work>
+void Spread(uint64_t iterations, int threads, Work &&work) {
+  std::vector<std::thread> workers;
+  uint64_t per_thread = iterations / threads;
+  for (int t = 0; t < threads; t++) {
+    uint64_t count = t == 0 ? iterations - per_thread * (threads - 1)
+                            : per_thread;
+    workers.emplace_back([&work, t, count] { work(t, count); });
+  }
+  for (auto &w : workers) w.join();
+}
+
+void *Nothing(void *) { return nullptr; }
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("thread_bench", argc, argv);
+  for (int i = 1; i < argc; i++)
+    fprintf(stderr, "%s: unknown option %s\n", argv[0], argv[i]);
+
+  for (int threads : kThreadCounts) {
+    for (bool shared : {true, false}) {
+      bench::Params params = {{"threads", std::to_string(threads)},
+                              {"contention", shared ? "shared" : "striped"}};
+
+      h.Run("counter/mutex", params, [&](uint64_t n) {
+        std::vector<PaddedMutexCounter> counters(threads);
+        Spread(n, threads, [&](int t, uint64_t count) {
+          PaddedMutexCounter &c = counters[shared ? 0 : t];
+          for (uint64_t i = 0; i < count; i++) {
+            std::lock_guard<std::mutex> guard(c.mutex);
+            c.value++;
+          }
+        });
+      });
+
+      h.Run("counter/atomic", params, [&](uint64_t n) {
+        std::vector<PaddedAtomicCounter> counters(threads);
+        Spread(n, threads, [&](int t, uint64_t count) {
+          PaddedAtomicCounter &c = counters[shared ? 0 : t];
+          for (uint64_t i = 0; i < count; i++)
+            c.value.fetch_add(1, std::memory_order_relaxed);
+        });
+      });
+    }
+  }
+
+  h.Run("pthread/create_join", {}, [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      pthread_t tid;
+      pthread_create(&tid, nullptr, Nothing, nullptr);
+      pthread_join(tid, nullptr);
+    }
+  });
+
+  h.Run("future/async_get", {}, [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      auto f = std::async(std::launch::async, [i] { return i * 2; });
+      bench::DoNotOptimize(f.get());
+    }
+  });
+
+  return h.Finish();
+}
@@ -0,0 +1,408 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "harness.h"
+#include "http_client.h"
+
+// Checks http::Client against a loopback stand-in server, then measures
+// the time per request: the Readme 4.2.4 way (resolve, connect, one
+// request, read to EOF) against pooled keep-alive connections with and
+// without pipelining.  Exits non-zero if a check fails.
+
+// Stand-in server, run in a child process.  Knows a few paths:
+//   /               "ok\n"
+//   /echo/<text>    <text>
+//   /body           the request body (POST)
+//   /chunked        chunked "hello, world" with a trailer
+//   /big            1 MiB body
+//   /continue       100 Continue, then "ok\n"
+//   /eof            HTTP/1.0, body delimited by close
+//   /close          "close\n" with Connection: close
+//   /slow           never answers
+
+struct Peer {
+  std::string in;
+  std::string out;
+  size_t out_pos = 0;
+  bool close_after = false;
+  bool stalled = false;
+};
+
+void Respond(const std::string &method, const std::string &path,
+             const std::string &body, bool close, Peer *peer) {
+  std::string content = "ok\n", extra;
+  if (path == "/slow") {
+    peer->stalled = true;
+    return;
+  } else if (path == "/chunked") {
+    peer->out += "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    if (method != "HEAD")
+      peer->out += "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nX-Sum: 1\r\n\r\n";
+    return;
+  } else if (path == "/eof") {
+    peer->out += "HTTP/1.0 200 OK\r\n\r\nuntil close\n";
+    peer->close_after = true;
+    return;
+  } else if (path == "/continue") {
+    peer->out += "HTTP/1.1 100 Continue\r\n\r\n";
+  } else if (path == "/big") {
+    content.assign(1 << 20, 'x');
+  } else if (path == "/body") {
+    content = body;
+  } else if (path.compare(0, 6, "/echo/") == 0) {
+    content = path.substr(6);
+  } else if (path == "/close") {
+    content = "close\n";
+    close = true;
+  }
+  if (close) extra = "Connection: close\r\n";
+  peer->out += "HTTP/1.1 200 OK\r\nContent-Length: " +
+               std::to_string(content.size()) + "\r\n" + extra + "\r\n";
+  if (method != "HEAD") peer->out += content;
+  peer->close_after = close;
+}
+
+void Serve(int listen_fd) {
+  int ep = epoll_create1(0);
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+  std::map<int, Peer> peers;
+  char buf[64 << 10];
+  while (true) {
+    epoll_event events[64];
+    int n = epoll_wait(ep, events, 64, -1);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listen_fd) {
+        int client = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (client == -1) continue;
+        peers[client] = Peer();
+        ev.events = EPOLLIN;
+        ev.data.fd = client;
+        epoll_ctl(ep, EPOLL_CTL_ADD, client, &ev);
+        continue;
+      }
+      Peer &peer = peers[fd];
+      bool gone = false;
+      if (events[i].events & EPOLLIN) {
+        ssize_t got = read(fd, buf, sizeof buf);
+        if (got > 0)
+          peer.in.append(buf, got);
+        else if (got == 0 || errno != EAGAIN)
+          gone = true;
+      }
+      size_t end;
+      while (!gone && !peer.stalled && !peer.close_after &&
+             (end = peer.in.find("\r\n\r\n")) != std::string::npos) {
+        std::string head = peer.in.substr(0, end + 2);
+        size_t length = 0;
+        size_t at = head.find("\r\nContent-Length: ");
+        if (at != std::string::npos) length = atoi(head.c_str() + at + 18);
+        if (peer.in.size() < end + 4 + length) break;
+        std::string body = peer.in.substr(end + 4, length);
+        peer.in.erase(0, end + 4 + length);
+        size_t sp1 = head.find(' '), sp2 = head.find(' ', sp1 + 1);
+        Respond(head.substr(0, sp1), head.substr(sp1 + 1, sp2 - sp1 - 1),
+                body, head.find("\r\nConnection: close") != std::string::npos,
+                &peer);
+      }
+      while (!gone && peer.out_pos < peer.out.size()) {
+        ssize_t sent = write(fd, peer.out.data() + peer.out_pos,
+                             peer.out.size() - peer.out_pos);
+        if (sent <= 0) break;
+        peer.out_pos += sent;
+      }
+      if (peer.out_pos == peer.out.size()) {
+        peer.out.clear();
+        peer.out_pos = 0;
+        if (peer.close_after) gone = true;
+      }
+      if (gone) {
+        close(fd);
+        peers.erase(fd);
+        continue;
+      }
+      ev.events = EPOLLIN;
+      if (!peer.out.empty()) ev.events |= EPOLLOUT;
+      ev.data.fd = fd;
+      epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+    }
+  }
+}
+
+int failures = 0;
+
+void Check(const char *name, bool ok) {
+  printf("  %-46s %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok) failures++;
+}
+
+// Runs one request to completion and returns its body, or "error:<n>".
+std::string Fetch(http::Client &client, const std::string &url,
+                  std::string method = "GET", std::string body = "") {
+  std::string result;
+  std::string host, path;
+  uint16_t port;
+  http::ParseUrl(url, &host, &port, &path);
+  client.Send(method, host, port, path, "", body,
+              [&](const http::Response *r, int error) {
+                if (r == nullptr)
+                  result = "error:" + std::to_string(error);
+                else
+                  result = std::to_string(r->status()) + " " + r->body();
+              });
+  client.Run();
+  return result;
+}
+
+// Feeds `wire` to a parser one byte at a time.
+std::string ParseByteWise(const std::string &wire) {
+  http::ResponseParser parser;
+  http::Response response;
+  parser.Reset(false);
+  for (size_t i = 0; i < wire.size(); i++) {
+    size_t used;
+    http::ResponseParser::Result result =
+        parser.Feed(&wire[i], 1, &used, &response);
+    if (result == http::ResponseParser::kError || used != 1) return "error";
+    if (result == http::ResponseParser::kDone)
+      return i + 1 == wire.size() ? response.body() : "early";
+  }
+  return "incomplete";
+}
+
+void RunChecks(const std::string &base, uint16_t dead_port) {
+  Check("parser fed one byte at a time",
+        ParseByteWise("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n"
+                      "X-A:  b \r\n\r\n3\r\nabc\r\n0\r\n\r\n") == "abc");
+  Check("Content-Length past 2^62 rejected",
+        ParseByteWise("HTTP/1.1 200 OK\r\nContent-Length: "
+                      "99999999999999999999\r\n\r\n") == "error");
+
+  http::Client client;
+  Check("GET /", Fetch(client, base + "/") == "200 ok\n");
+  Check("chunked body with extension and trailer",
+        Fetch(client, base + "/chunked") == "200 hello, world");
+  Check("1 MiB body", Fetch(client, base + "/big").size() == 4 + (1 << 20));
+  Check("HEAD has no body", Fetch(client, base + "/", "HEAD") == "200 ");
+  Check("GET after HEAD on the same connection",
+        Fetch(client, base + "/echo/after") == "200 after");
+  Check("100 Continue skipped",
+        Fetch(client, base + "/continue") == "200 ok\n");
+  Check("HTTP/1.0 body delimited by close",
+        Fetch(client, base + "/eof") == "200 until close\n");
+  Check("POST body", Fetch(client, base + "/body", "POST", "payload") ==
+                         "200 payload");
+  http::Stats s = client.stats();
+  Check("keep-alive reuse and one DNS lookup",
+        s.reused >= 5 && s.dns_misses == 1);
+
+  // Pipelining keeps order on a single connection.
+  http::Options one;
+  one.max_connections_per_host = 1;
+  http::Client piped(one);
+  int in_order = 0;
+  for (int i = 0; i < 200; i++) {
+    piped.Get(base + "/echo/" + std::to_string(i),
+              [&in_order, i](const http::Response *r, int) {
+                if (r != nullptr && r->body() == std::to_string(i)) in_order++;
+              });
+  }
+  piped.Run();
+  s = piped.stats();
+  Check("200 pipelined requests answered in order",
+        in_order == 200 && s.connects == 1 && s.pipelined > 0);
+
+  // Connection: close with requests pipelined behind it.
+  http::Client closing(one);
+  int ok = 0;
+  for (const char *path : {"/echo/a", "/close", "/echo/b", "/echo/c"}) {
+    closing.Get(base + path, [&ok](const http::Response *r, int) {
+      if (r != nullptr && r->status() == 200) ok++;
+    });
+  }
+  closing.Run();
+  s = closing.stats();
+  Check("requests behind Connection: close are retried",
+        ok == 4 && s.connects == 2 && s.retries == 2);
+
+  Check("connection refused",
+        Fetch(client, "http://127.0.0.1:" + std::to_string(dead_port) + "/") ==
+            "error:" + std::to_string(ECONNREFUSED));
+  Check("unresolvable host", Fetch(client, "http://no-such-host.invalid/") ==
+                                 "error:" + std::to_string(EHOSTUNREACH));
+  http::Options quick;
+  quick.timeout_ms = 200;
+  http::Client impatient(quick);
+  Check("timeout", Fetch(impatient, base + "/slow") ==
+                       "error:" + std::to_string(ETIMEDOUT));
+  Check("bad URL rejected",
+        !client.Get("ftp://x/", nullptr) && errno == EINVAL);
+
+  // Nothing may reach the wire that splits or adds a request.
+  Check("CR/LF in URL rejected",
+        !client.Get(base + "/a b\r\nX-Evil: 1\r\n\r\nGET /smuggled",
+                    nullptr) &&
+            errno == EINVAL);
+  Check("bad method, path or headers rejected",
+        !client.Send("GET /x", "h", 80, "/", "", "", nullptr) &&
+            !client.Send("GET", "h", 80, "/a\r\n", "", "", nullptr) &&
+            !client.Send("GET", "h\r\n", 80, "/", "", "", nullptr) &&
+            !client.Send("GET", "h", 80, "/", "X: 1\r\n\r\nGET / ", "",
+                         nullptr) &&
+            !client.Send("GET", "h", 80, "/", "X: 1", "", nullptr) &&
+            errno == EINVAL && client.outstanding() == 0);
+  std::string host, path;
+  uint16_t port;
+  Check("authority ends at ?, port needs : after ]",
+        http::ParseUrl("http://h?q=1#f", &host, &port, &path) &&
+            host == "h" && port == 80 && path == "/?q=1" &&
+            !http::ParseUrl("http://[::1]x8080/", &host, &port, &path) &&
+            http::ParseUrl("http://[::1]:8080", &host, &port, &path) &&
+            host == "::1" && port == 8080 && path == "/");
+
+  http::Options small;
+  small.max_body = 8;
+  http::Client bounded(small);
+  Check("body over max_body fails with EMSGSIZE",
+        Fetch(bounded, base + "/big") == "error:" + std::to_string(EMSGSIZE) &&
+            Fetch(bounded, base + "/chunked") ==
+                "error:" + std::to_string(EMSGSIZE) &&
+            Fetch(bounded, base + "/eof") ==
+                "error:" + std::to_string(EMSGSIZE) &&
+            Fetch(bounded, base + "/") == "200 ok\n");
+}
+
+// Readme 4.2.4: resolve, connect, request, read to EOF, every time.
+bool BlockingGet(const char *host, uint16_t port) {
+  addrinfo hints = {}, *list;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, nullptr, &hints, &list) != 0) return false;
+  sockaddr_in addr = *reinterpret_cast<sockaddr_in *>(list->ai_addr);
+  freeaddrinfo(list);
+  addr.sin_port = htons(port);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1) {
+    close(fd);
+    return false;
+  }
+  char buffer[8192];
+  int n = snprintf(buffer, sizeof buffer,
+                   "GET / HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                   host);
+  write(fd, buffer, n);
+  ssize_t got, total = 0;
+  while ((got = read(fd, buffer, sizeof buffer)) > 0) total += got;
+  close(fd);
+  return total > 0;
+}
+
+// Keeps `window` requests outstanding until `total` have completed.
+void Drive(bench::Harness &h, const std::string &url, int total, int window,
+           http::Options options) {
+  http::Client client(options);
+  int issued = 0, good = 0;
+  std::function<void()> issue = [&] {
+    issued++;
+    client.Get(url, [&](const http::Response *r, int) {
+      if (r != nullptr && r->status() == 200) good++;
+      if (issued < total) issue();
+    });
+  };
+  bool ran = h.Once("get/keep_alive",
+                    {{"connections",
+                      std::to_string(options.max_connections_per_host)},
+                     {"pipeline", std::to_string(options.max_pipeline)}},
+                    total, [&] {
+                      for (int i = 0; i < window && issued < total; i++)
+                        issue();
+                      client.Run();
+                    }) > 0;
+  if (!ran) return;
+  http::Stats s = client.stats();
+  printf("    %lu connects, %lu pipelined%s\n", s.connects, s.pipelined,
+         good == total ? "" : "  ERRORS");
+  if (good != total) failures++;
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("http_bench", argc, argv);
+  int total = argc > 1 ? atoi(argv[1]) : 200000;
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof addr;
+  bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr);
+  listen(listen_fd, 1024);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  uint16_t port = ntohs(addr.sin_port);
+
+  // A port nothing listens on.
+  int dead = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in dead_addr = addr;
+  dead_addr.sin_port = 0;
+  bind(dead, reinterpret_cast<sockaddr *>(&dead_addr), sizeof dead_addr);
+  getsockname(dead, reinterpret_cast<sockaddr *>(&dead_addr), &len);
+  uint16_t dead_port = ntohs(dead_addr.sin_port);
+  close(dead);
+
+  pid_t server = fork();
+  if (server == 0) {
+    Serve(listen_fd);
+    _exit(0);
+  }
+  close(listen_fd);
+
+  std::string base = "http://localhost:" + std::to_string(port);
+  printf("checks against %s\n", base.c_str());
+  RunChecks(base, dead_port);
+
+  printf("\n%d requests for %s/\n", total, base.c_str());
+  int blocking = total / 40;
+  bool ok = true;
+  h.Once("get/resolve_connect", {}, blocking, [&] {
+    for (int i = 0; i < blocking; i++) ok &= BlockingGet("localhost", port);
+  });
+  if (!ok) {
+    printf("    ERRORS\n");
+    failures++;
+  }
+
+  http::Options options;
+  options.max_connections_per_host = 1;
+  options.max_pipeline = 1;
+  Drive(h, base + "/", total, 1, options);
+  options.max_connections_per_host = 8;
+  Drive(h, base + "/", total, 64, options);
+  options.max_connections_per_host = 1;
+  options.max_pipeline = 16;
+  Drive(h, base + "/", total, 16, options);
+  options.max_connections_per_host = 8;
+  Drive(h, base + "/", total, 128, options);
+
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+  return failures ? 1 : h.Finish();
+}
@@ -0,0 +1,1036 @@
+#ifndef NETWORK_HTTP_HTTP_CLIENT_H_
+#define NETWORK_HTTP_HTTP_CLIENT_H_
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// HTTP/1.1 client for many small requests to a few hosts, replacing the
+// one-shot GetHomepage client of Readme 4.2.4.
+//
+//   http::Client client;
+//   client.Get("http://localhost:8080/health",
+//              [](const http::Response *r, int error) {
+//                if (r != nullptr) printf("%d %s", r->status(), ...);
+//                else printf("failed: %s\n", strerror(error));
+//              });
+//   client.Run();   // until every request has called back
+//
+// Everything runs on the calling thread around one epoll instance.  Each
+// host:port has a pool of keep-alive connections, opened with
+// non-blocking connect() as demand grows up to max_connections_per_host.
+// A request goes to an idle connection, else to a new one, else is
+// pipelined behind requests already in flight, up to max_pipeline deep;
+// only GET, HEAD, OPTIONS, PUT and DELETE are pipelined.  Requests queued
+// together leave in one send().  Responses are parsed incrementally
+// straight out of the read buffer into a Response that the connection
+// reuses, so a steady stream of requests stops allocating.  Addresses
+// are resolved once per dns_ttl_ms rather than per request.
+//
+// Idempotent requests are retried once when a reused connection turns
+// out to be closed, or when the server closes with pipelined requests
+// still unanswered.  Errors are reported as errno values: ECONNREFUSED,
+// ETIMEDOUT, ECONNRESET, EHOSTUNREACH (resolution failed), EPROTO
+// (malformed response), EMSGSIZE (body over max_body); one that fails
+// straight away is called back from inside Send().  A method, host, path
+// or header that would let CR, LF or whitespace into the request is
+// refused up front with EINVAL.  Plain http:// only.
+namespace http {
+
+namespace detail {
+
+inline uint64_t NowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+inline bool EqualsNoCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Whether comma-separated `list` contains `token`, ignoring case.
+inline bool HasToken(std::string_view list, std::string_view token) {
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+      item.remove_prefix(1);
+    while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+      item.remove_suffix(1);
+    if (EqualsNoCase(item, token)) return true;
+    if (comma == std::string_view::npos) break;
+    list.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// RFC 7230 token, as in a method or header name.
+inline bool IsToken(std::string_view s) {
+  if (s.empty()) return false;
+  for (unsigned char c : s)
+    if (c <= ' ' || c >= 0x7f || strchr("\"(),/:;<=>?@[\\]{}", c))
+      return false;
+  return true;
+}
+
+// No controls, spaces or DEL: safe to place in a request or Host line.
+inline bool IsVisible(std::string_view s) {
+  for (unsigned char c : s)
+    if (c <= ' ' || c == 0x7f) return false;
+  return true;
+}
+
+// Whether `headers` is whole "Name: value\r\n" lines whose values hold no
+// CR, LF or NUL, so nothing can be smuggled in after them.
+inline bool IsHeaderBlock(std::string_view headers) {
+  while (!headers.empty()) {
+    size_t eol = headers.find("\r\n");
+    if (eol == std::string_view::npos) return false;
+    std::string_view line = headers.substr(0, eol);
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos || !IsToken(line.substr(0, colon)))
+      return false;
+    for (char c : line.substr(colon + 1))
+      if (c == '\r' || c == '\n' || c == '\0') return false;
+    headers.remove_prefix(eol + 2);
+  }
+  return true;
+}
+
+}  // namespace detail
+
+// One response.  Views point into the response's own buffers and stay
+// valid until the callback returns.
+class Response {
+ public:
+  using Header = std::pair<std::string_view, std::string_view>;
+
+  int status() const { return status_; }
+  std::string_view reason() const { return reason_; }
+  const std::vector<Header> &headers() const { return headers_; }
+  const std::string &body() const { return body_; }
+  bool keep_alive() const { return keep_alive_; }
+
+  // First header named `name` (any case), or an empty view.
+  std::string_view header(std::string_view name) const {
+    for (const Header &h : headers_)
+      if (detail::EqualsNoCase(h.first, name)) return h.second;
+    return {};
+  }
+
+ private:
+  friend class ResponseParser;
+
+  std::string head_;  // status line and header block, CRLFCRLF included
+  std::string body_;  // de-chunked
+  std::vector<Header> headers_;
+  std::string_view reason_;
+  int status_ = 0;
+  bool keep_alive_ = true;
+};
+
+// Incremental response parser: feed it whatever arrived, in any pieces.
+class ResponseParser {
+ public:
+  enum Result { kNeedMore, kDone, kError };
+
+  static constexpr size_t kMaxHead = 64 << 10;
+  static constexpr size_t kMaxLine = 4 << 10;
+
+  explicit ResponseParser(uint64_t max_body = UINT64_MAX)
+      : max_body_(max_body) {}
+
+  // Prepares for the next response; replies to HEAD have no body.
+  void Reset(bool head_request) {
+    state_ = kStart;
+    head_request_ = head_request;
+  }
+
+  // True once any byte of the current response has been consumed.
+  bool started() const { return state_ != kStart; }
+
+  // Whether the last kError was a body longer than max_body.
+  bool too_large() const { return too_large_; }
+
+  // Consumes up to `size` bytes into `r` and says how many in `*used`.
+  // Stops right after a complete response, leaving the rest unread.
+  Result Feed(const char *data, size_t size, size_t *used, Response *r) {
+    size_t pos = 0;
+    Result result = kNeedMore;
+    while (result == kNeedMore && (pos < size || state_ == kComplete)) {
+      switch (state_) {
+        case kStart:
+          too_large_ = false;
+          r->head_.clear();
+          r->body_.clear();
+          r->headers_.clear();
+          state_ = kHead;
+          break;
+        case kHead:
+          result = FeedHead(data, size, &pos, r);
+          break;
+        case kLength:
+        case kChunkData: {
+          size_t n = std::min<uint64_t>(remaining_, size - pos);
+          r->body_.append(data + pos, n);
+          pos += n;
+          remaining_ -= n;
+          if (remaining_ == 0)
+            state_ = state_ == kLength ? kComplete : kChunkEnd;
+          break;
+        }
+        case kChunkSize:
+        case kChunkEnd:
+        case kTrailer:
+          result = FeedLine(data, size, &pos, r);
+          break;
+        case kUntilClose:
+          if (size - pos > max_body_ - r->body_.size()) {
+            too_large_ = true;
+            result = kError;
+            break;
+          }
+          r->body_.append(data + pos, size - pos);
+          pos = size;
+          break;
+        case kComplete:
+          result = kDone;
+          break;
+      }
+    }
+    *used = pos;
+    return result;
+  }
+
+  // At end of stream: completes a body that was delimited by the close.
+  Result Finish() {
+    if (state_ != kUntilClose) return kError;
+    state_ = kComplete;
+    return kDone;
+  }
+
+ private:
+  enum State {
+    kStart,
+    kHead,
+    kLength,
+    kChunkSize,
+    kChunkData,
+    kChunkEnd,
+    kTrailer,
+    kUntilClose,
+    kComplete
+  };
+
+  // Copies header bytes up to and including the blank line.  Only the
+  // head is copied, never the responses pipelined behind it.
+  Result FeedHead(const char *data, size_t size, size_t *pos, Response *r) {
+    static const char kEnd[] = "\r\n\r\n";
+    const char *begin = data + *pos;
+    size_t avail = size - *pos, old = r->head_.size(), take = 0;
+    for (size_t k = 3; k >= 1 && take == 0; k--) {  // split across pieces
+      if (old >= k && r->head_.compare(old - k, k, kEnd, k) == 0 &&
+          avail >= 4 - k && memcmp(begin, kEnd + k, 4 - k) == 0)
+        take = 4 - k;
+    }
+    if (take == 0) {
+      const char *hit =
+          static_cast<const char *>(memmem(begin, avail, kEnd, 4));
+      if (hit == nullptr) {
+        r->head_.append(begin, avail);
+        *pos = size;
+        return r->head_.size() > kMaxHead ? kError : kNeedMore;
+      }
+      take = hit + 4 - begin;
+    }
+    r->head_.append(begin, take);
+    *pos += take;
+    if (!ParseHead(r)) return kError;
+    if (r->status_ / 100 == 1 && r->status_ != 101) {
+      state_ = kStart;  // interim response: the real one follows
+    } else if (head_request_ || r->status_ == 204 || r->status_ == 304) {
+      state_ = kComplete;
+    }
+    return kNeedMore;
+  }
+
+  bool ParseHead(Response *r) {
+    std::string_view head = r->head_;
+    size_t eol = head.find("\r\n");
+    std::string_view line = head.substr(0, eol);
+    // HTTP/1.x SSS reason
+    if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ')
+      return false;
+    bool http10 = line[7] == '0';
+    int status = 0;
+    for (int i = 9; i < 12; i++) {
+      if (line[i] < '0' || line[i] > '9') return false;
+      status = status * 10 + line[i] - '0';
+    }
+    r->status_ = status;
+    r->reason_ = line.size() > 13 ? line.substr(13) : std::string_view();
+
+    bool chunked = false, close = false, keep_alive = false;
+    int64_t length = -1;
+    head.remove_prefix(eol + 2);
+    while (!head.empty() && head.substr(0, 2) != "\r\n") {
+      eol = head.find("\r\n");
+      line = head.substr(0, eol);
+      head.remove_prefix(eol + 2);
+      size_t colon = line.find(':');
+      if (colon == 0 || colon == std::string_view::npos) return false;
+      std::string_view name = line.substr(0, colon);
+      std::string_view value = line.substr(colon + 1);
+      while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+      while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+        value.remove_suffix(1);
+      r->headers_.emplace_back(name, value);
+
+      if (detail::EqualsNoCase(name, "content-length")) {
+        if (value.empty()) return false;
+        length = 0;
+        for (char c : value) {
+          if (c < '0' || c > '9' || length >> 58) return false;
+          length = length * 10 + c - '0';  // below 2^62
+        }
+      } else if (detail::EqualsNoCase(name, "transfer-encoding")) {
+        chunked = detail::HasToken(value, "chunked");
+      } else if (detail::EqualsNoCase(name, "connection")) {
+        close |= detail::HasToken(value, "close");
+        keep_alive |= detail::HasToken(value, "keep-alive");
+      }
+    }
+
+    r->keep_alive_ = !close && (!http10 || keep_alive);
+    if (chunked) {
+      state_ = kChunkSize;
+    } else if (length >= 0) {
+      if (uint64_t(length) > max_body_) {
+        too_large_ = true;
+        return false;
+      }
+      remaining_ = length;
+      state_ = length ? kLength : kComplete;
+    } else {
+      state_ = kUntilClose;
+      r->keep_alive_ = false;
+    }
+    return true;
+  }
+
+  // Chunk-size lines, the CRLF after chunk data, and trailer lines.
+  Result FeedLine(const char *data, size_t size, size_t *pos,
+                  const Response *r) {
+    const char *nl =
+        static_cast<const char *>(memchr(data + *pos, '\n', size - *pos));
+    size_t n = (nl ? nl + 1 - data : size) - *pos;
+    line_.append(data + *pos, n);
+    *pos += n;
+    if (nl == nullptr) return line_.size() > kMaxLine ? kError : kNeedMore;
+    std::string_view line = line_;
+    line.remove_suffix(line.size() >= 2 && line[line.size() - 2] == '\r' ? 2
+                                                                         : 1);
+    Result result = kNeedMore;
+    if (state_ == kChunkSize) {
+      uint64_t chunk = 0;
+      size_t digits = 0;
+      for (; digits < line.size(); digits++) {
+        char c = line[digits];
+        int v = c >= '0' && c <= '9'   ? c - '0'
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                       : -1;
+        if (v < 0) break;
+        if (chunk >> 60) return kError;
+        chunk = chunk * 16 + v;
+      }
+      if (digits == 0) result = kError;
+      if (chunk > max_body_ - r->body_.size()) {
+        too_large_ = true;
+        result = kError;
+      }
+      remaining_ = chunk;
+      state_ = chunk ? kChunkData : kTrailer;
+    } else if (state_ == kChunkEnd) {
+      if (!line.empty()) result = kError;
+      state_ = kChunkSize;
+    } else if (line.empty()) {  // end of trailer
+      state_ = kComplete;
+    }
+    line_.clear();
+    return result;
+  }
+
+  State state_ = kStart;
+  bool head_request_ = false;
+  bool too_large_ = false;
+  uint64_t max_body_;
+  uint64_t remaining_ = 0;
+  std::string line_;
+};
+
+using Callback = std::function<void(const Response *response, int error)>;
+
+struct Options {
+  int max_connections_per_host = 8;
+  int max_pipeline = 16;  // requests in flight per connection; 1 disables
+  int timeout_ms = 10000;  // per request, from submission
+  int idle_timeout_ms = 30000;
+  int dns_ttl_ms = 60000;
+  uint64_t max_body = 64 << 20;  // longer responses fail with EMSGSIZE
+};
+
+struct Stats {
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t connects;
+  uint64_t reused;     // sent on a connection that had already answered
+  uint64_t pipelined;  // sent while another was in flight on the connection
+  uint64_t retries;
+  uint64_t dns_hits;
+  uint64_t dns_misses;
+};
+
+// Caches getaddrinfo() results per host for a fixed TTL, since the
+// resolver does not report the record's own.  A miss blocks the caller.
+class Resolver {
+ public:
+  struct Address {
+    sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  explicit Resolver(int ttl_ms) : ttl_ms_(ttl_ms) {}
+
+  // Addresses of `host` with `port` filled in, or nullptr.
+  const std::vector<Address> *Resolve(const std::string &host,
+                                      uint16_t port) {
+    uint64_t now = detail::NowMs();
+    Entry &entry = cache_[host];
+    if (entry.expires > now && !entry.addresses.empty()) {
+      hits_++;
+    } else {
+      misses_++;
+      entry.addresses.clear();
+      addrinfo hints = {};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo *list;
+      if (getaddrinfo(host.c_str(), nullptr, &hints, &list) != 0)
+        return nullptr;
+      for (addrinfo *ai = list; ai != nullptr; ai = ai->ai_next) {
+        Address a = {};
+        memcpy(&a.addr, ai->ai_addr, ai->ai_addrlen);
+        a.len = ai->ai_addrlen;
+        entry.addresses.push_back(a);
+      }
+      freeaddrinfo(list);
+      entry.expires = now + ttl_ms_;
+    }
+    entry.with_port = entry.addresses;
+    for (Address &a : entry.with_port) {
+      if (a.addr.ss_family == AF_INET)
+        reinterpret_cast<sockaddr_in *>(&a.addr)->sin_port = htons(port);
+      else if (a.addr.ss_family == AF_INET6)
+        reinterpret_cast<sockaddr_in6 *>(&a.addr)->sin6_port = htons(port);
+    }
+    return &entry.with_port;
+  }
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    std::vector<Address> addresses;
+    std::vector<Address> with_port;
+    uint64_t expires = 0;
+  };
+
+  int ttl_ms_;
+  std::unordered_map<std::string, Entry> cache_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+// Splits "http://host[:port][/path][?query][#fragment]" ("[v6]" hosts
+// allowed); the fragment is dropped.  URLs holding controls or spaces are
+// rejected rather than written into the request line.
+inline bool ParseUrl(std::string_view url, std::string *host, uint16_t *port,
+                     std::string *path) {
+  if (url.substr(0, 7) != "http://" || !detail::IsVisible(url)) return false;
+  url.remove_prefix(7);
+  url = url.substr(0, url.find('#'));
+  size_t end = url.find_first_of("/?");
+  std::string_view authority = url.substr(0, end);
+  *path = end == std::string_view::npos ? std::string("/")
+                                        : std::string(url.substr(end));
+  if (path->front() == '?') path->insert(0, "/");
+  size_t colon = authority.rfind(':');
+  if (!authority.empty() && authority.front() == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string_view::npos) return false;
+    *host = std::string(authority.substr(1, close - 1));
+    colon = close + 1;
+    if (colon == authority.size()) {
+      colon = std::string_view::npos;
+    } else if (authority[colon] != ':') {
+      return false;
+    }
+  } else {
+    *host = std::string(authority.substr(0, colon));
+  }
+  *port = 80;
+  if (colon != std::string_view::npos) {
+    unsigned value = 0;
+    std::string_view digits = authority.substr(colon + 1);
+    for (char c : digits) {
+      if (c < '0' || c > '9' || value > 65535) return false;
+      value = value * 10 + c - '0';
+    }
+    if (digits.empty() || value == 0 || value > 65535) return false;
+    *port = value;
+  }
+  return !host->empty();
+}
+
+class Client {
+ public:
+  explicit Client(Options options = Options())
+      : options_(options), resolver_(options.dns_ttl_ms) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (options_.max_pipeline < 1) options_.max_pipeline = 1;
+    if (options_.max_connections_per_host < 1)
+      options_.max_connections_per_host = 1;
+  }
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  // Outstanding requests are dropped without a callback.
+  ~Client() {
+    for (auto &entry : pools_)
+      for (auto &c : entry.second->connections)
+        if (c->fd != -1) close(c->fd);
+    if (epoll_fd_ != -1) close(epoll_fd_);
+  }
+
+  // Returns false with errno EINVAL for a URL ParseUrl() rejects.
+  bool Get(std::string_view url, Callback callback) {
+    std::string host, path;
+    uint16_t port;
+    if (!ParseUrl(url, &host, &port, &path)) {
+      errno = EINVAL;
+      return false;
+    }
+    return Send("GET", host, port, std::move(path), "", "",
+                std::move(callback));
+  }
+
+  // `headers` are extra "Name: value\r\n" lines.  Host, and Content-Length
+  // for a body, are added.  Returns false with errno EINVAL, without
+  // calling back, if any argument would break the request's framing.
+  bool Send(std::string method, const std::string &host, uint16_t port,
+            std::string path, std::string headers, std::string body,
+            Callback callback) {
+    if (!detail::IsToken(method) || host.empty() ||
+        !detail::IsVisible(host) || path.empty() ||
+        !detail::IsVisible(path) || !detail::IsHeaderBlock(headers)) {
+      errno = EINVAL;
+      return false;
+    }
+    auto request = std::make_unique<Request>();
+    request->method = std::move(method);
+    request->path = std::move(path);
+    request->headers = std::move(headers);
+    request->body = std::move(body);
+    request->callback = std::move(callback);
+    request->deadline = detail::NowMs() + options_.timeout_ms;
+    Pool *pool = GetPool(host, port);
+    pool->waiting.push_back(std::move(request));
+    outstanding_++;
+    stats_.requests++;
+    Dispatch(pool);
+    return true;
+  }
+
+  // Requests that have not called back yet.
+  size_t outstanding() const { return outstanding_; }
+
+  // Waits up to `timeout_ms` (-1: until something happens) for I/O, then
+  // runs whatever is ready, including callbacks and timeouts.
+  void Poll(int timeout_ms) {
+    uint64_t now = detail::NowMs();
+    int until_sweep = next_sweep_ > now ? next_sweep_ - now : 0;
+    if (timeout_ms < 0 || timeout_ms > until_sweep) timeout_ms = until_sweep;
+    epoll_event events[64];
+    int n = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++) {
+      Connection *c = static_cast<Connection *>(events[i].data.ptr);
+      if (c->fd == -1) continue;  // failed earlier in this batch
+      if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) OnWritable(c);
+      if (c->fd != -1 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        OnReadable(c);
+    }
+    if (detail::NowMs() >= next_sweep_) Sweep();
+    graveyard_.clear();
+  }
+
+  // Polls until every request has called back.
+  void Run() {
+    while (outstanding_ > 0) Poll(-1);
+  }
+
+  Stats stats() const {
+    Stats s = stats_;
+    s.dns_hits = resolver_.hits();
+    s.dns_misses = resolver_.misses();
+    return s;
+  }
+
+ private:
+  static constexpr int kSweepMs = 10;
+  static constexpr size_t kReadChunk = 64 << 10;
+
+  struct Request {
+    std::string method;
+    std::string path;
+    std::string headers;
+    std::string body;
+    Callback callback;
+    uint64_t deadline;
+    int retries = 0;
+  };
+
+  struct Pool;
+
+  struct Connection {
+    Pool *pool;
+    int fd = -1;
+    bool connecting = false;
+    bool answered = false;  // has completed a response
+    bool closing = false;   // server said close; take no more requests
+    uint32_t events = 0;
+    std::vector<Resolver::Address> addresses;
+    size_t next_address = 0;
+    std::string out;
+    size_t out_pos = 0;
+    std::unique_ptr<char[]> in;  // unread bytes are [in_begin, in_end)
+    size_t in_capacity = 0;
+    size_t in_begin = 0;
+    size_t in_end = 0;
+    std::deque<std::unique_ptr<Request>> inflight;
+    ResponseParser parser;
+    Response response;
+    uint64_t idle_since = 0;
+  };
+
+  struct Pool {
+    std::string host;
+    uint16_t port;
+    std::string host_header;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::deque<std::unique_ptr<Request>> waiting;
+  };
+
+  // How a failing connection disposes of its in-flight requests.
+  enum Disposal {
+    kFailAll,    // same error for all: the connection never came up
+    kFailFirst,  // the first gets the error, idempotent others retry
+    kRetryAll    // idempotent ones retry, others get the error
+  };
+
+  static bool Idempotent(const std::string &method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+           method == "PUT" || method == "DELETE";
+  }
+
+  Pool *GetPool(const std::string &host, uint16_t port) {
+    std::string key = host + ":" + std::to_string(port);
+    std::unique_ptr<Pool> &pool = pools_[key];
+    if (pool == nullptr) {
+      pool.reset(new Pool);
+      pool->host = host;
+      pool->port = port;
+      bool v6 = host.find(':') != std::string::npos;
+      pool->host_header = v6 ? "[" + host + "]" : host;
+      if (port != 80) pool->host_header += ":" + std::to_string(port);
+    }
+    return pool.get();
+  }
+
+  // Assigns waiting requests to connections, opening some if allowed, and
+  // sends what was assigned.
+  void Dispatch(Pool *pool) {
+    std::vector<Connection *> touched;
+    while (!pool->waiting.empty()) {
+      Request *request = pool->waiting.front().get();
+      Connection *best = nullptr;
+      for (auto &c : pool->connections) {
+        if (c->closing) continue;
+        size_t depth = c->inflight.size();
+        if (depth == 0) {
+          best = c.get();
+          break;
+        }
+        if (Idempotent(request->method) &&
+            Idempotent(c->inflight.back()->method) &&
+            depth < size_t(options_.max_pipeline) &&
+            (best == nullptr || depth < best->inflight.size()))
+          best = c.get();
+      }
+      if ((best == nullptr || !best->inflight.empty()) &&
+          pool->connections.size() <
+              size_t(options_.max_connections_per_host)) {
+        Connection *fresh = Open(pool);
+        if (fresh == nullptr) break;  // waiting requests have failed
+        best = fresh;
+      }
+      if (best == nullptr) break;  // every connection is full
+
+      if (best->inflight.empty()) {
+        best->parser.Reset(request->method == "HEAD");
+        if (best->answered) stats_.reused++;
+      } else {
+        stats_.pipelined++;
+      }
+      Serialize(pool, *request, &best->out);
+      best->inflight.push_back(std::move(pool->waiting.front()));
+      pool->waiting.pop_front();
+      if (std::find(touched.begin(), touched.end(), best) == touched.end())
+        touched.push_back(best);
+    }
+    for (Connection *c : touched)
+      if (c->fd != -1 && !c->connecting) Flush(c);
+  }
+
+  static void Serialize(const Pool *pool, const Request &r, std::string *out) {
+    out->append(r.method).append(" ").append(r.path);
+    out->append(" HTTP/1.1\r\nHost: ").append(pool->host_header);
+    out->append("\r\n").append(r.headers);
+    if (!r.body.empty() || r.method == "POST" || r.method == "PUT")
+      out->append("Content-Length: ")
+          .append(std::to_string(r.body.size()))
+          .append("\r\n");
+    out->append("\r\n").append(r.body);
+  }
+
+  // Starts a connection for `pool`, or fails every waiting request if the
+  // host does not resolve or the connect fails outright.
+  Connection *Open(Pool *pool) {
+    const std::vector<Resolver::Address> *addresses =
+        resolver_.Resolve(pool->host, pool->port);
+    if (addresses == nullptr || addresses->empty()) {
+      FailWaiting(pool, EHOSTUNREACH);
+      return nullptr;
+    }
+    auto c = std::make_unique<Connection>();
+    c->pool = pool;
+    c->parser = ResponseParser(options_.max_body);
+    c->addresses = *addresses;
+    c->idle_since = detail::NowMs();
+    int error = Connect(c.get());
+    if (error != 0) {
+      FailWaiting(pool, error);
+      return nullptr;
+    }
+    pool->connections.push_back(std::move(c));
+    return pool->connections.back().get();
+  }
+
+  // For failures that would hit every request to the host alike.
+  void FailWaiting(Pool *pool, int error) {
+    std::deque<std::unique_ptr<Request>> failed;
+    failed.swap(pool->waiting);
+    for (auto &r : failed) Complete(r.get(), nullptr, error);
+  }
+
+  // Tries addresses from next_address on.  Returns 0 once one is
+  // connected or in progress, else the last error.
+  int Connect(Connection *c) {
+    int error = EHOSTUNREACH;
+    for (; c->next_address < c->addresses.size(); c->next_address++) {
+      const Resolver::Address &a = c->addresses[c->next_address];
+      int fd = socket(a.addr.ss_family,
+                      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == -1) {
+        error = errno;
+        continue;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+      int rc = connect(fd, reinterpret_cast<const sockaddr *>(&a.addr), a.len);
+      if (rc == 0 || errno == EINPROGRESS) {
+        stats_.connects++;
+        c->fd = fd;
+        c->connecting = rc != 0;
+        c->events = EPOLLIN | EPOLLOUT;
+        epoll_event ev = {};
+        ev.events = c->events;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        return 0;
+      }
+      error = errno;
+      close(fd);
+    }
+    return error;
+  }
+
+  void OnWritable(Connection *c) {
+    if (c->connecting) {
+      int error = 0;
+      socklen_t len = sizeof error;
+      if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        error = errno;
+      if (error != 0) {
+        // Try the host's next address, if any.
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, nullptr);
+        close(c->fd);
+        c->fd = -1;
+        c->next_address++;
+        if (Connect(c) != 0) Fail(c, error, kFailAll);
+        return;
+      }
+      c->connecting = false;
+    }
+    Flush(c);
+  }
+
+  void Flush(Connection *c) {
+    while (c->out_pos < c->out.size()) {
+      ssize_t n = send(c->fd, c->out.data() + c->out_pos,
+                       c->out.size() - c->out_pos, MSG_NOSIGNAL);
+      if (n > 0) {
+        c->out_pos += n;
+      } else if (n == -1 && errno == EINTR) {
+        continue;
+      } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        Fail(c, errno, c->answered ? kRetryAll : kFailFirst);
+        return;
+      }
+    }
+    if (c->out_pos == c->out.size()) {
+      c->out.clear();
+      c->out_pos = 0;
+    }
+    uint32_t want = EPOLLIN;
+    if (!c->out.empty()) want |= EPOLLOUT;
+    if (want != c->events) {
+      c->events = want;
+      epoll_event ev = {};
+      ev.events = want;
+      ev.data.ptr = c;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+  }
+
+  void OnReadable(Connection *c) {
+    while (true) {
+      if (c->in_begin == c->in_end) c->in_begin = c->in_end = 0;
+      if (c->in_capacity - c->in_end < kReadChunk / 2) {
+        size_t unread = c->in_end - c->in_begin;
+        if (unread + kReadChunk > c->in_capacity) {
+          size_t capacity = std::max(2 * c->in_capacity, unread + kReadChunk);
+          std::unique_ptr<char[]> grown(new char[capacity]);
+          memcpy(grown.get(), c->in.get() + c->in_begin, unread);
+          c->in = std::move(grown);
+          c->in_capacity = capacity;
+        } else {
+          memmove(c->in.get(), c->in.get() + c->in_begin, unread);
+        }
+        c->in_begin = 0;
+        c->in_end = unread;
+      }
+      size_t room = c->in_capacity - c->in_end;
+      ssize_t n = recv(c->fd, c->in.get() + c->in_end, room, 0);
+      if (n > 0) {
+        c->in_end += n;
+        if (!ParseResponses(c)) return;
+        if (size_t(n) < room) return;
+      } else if (n == -1 && errno == EINTR) {
+        continue;
+      } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      } else {
+        OnEnd(c, n == 0 ? ECONNRESET : errno);
+        return;
+      }
+    }
+  }
+
+  // End of stream or a read error.
+  void OnEnd(Connection *c, int error) {
+    if (!c->inflight.empty() && c->parser.Finish() == ResponseParser::kDone) {
+      if (!CompleteFirst(c)) return;
+    }
+    if (c->inflight.empty()) {
+      Close(c);
+      return;
+    }
+    bool stale = c->answered && !c->parser.started();
+    Fail(c, error, stale ? kRetryAll : kFailFirst);
+  }
+
+  // Hands every complete response in the read buffer to its request.
+  // Returns false if the connection is gone.
+  bool ParseResponses(Connection *c) {
+    while (c->in_begin < c->in_end) {
+      if (c->inflight.empty()) {  // nothing was asked
+        Fail(c, EPROTO, kFailFirst);
+        return false;
+      }
+      size_t used;
+      ResponseParser::Result result =
+          c->parser.Feed(c->in.get() + c->in_begin, c->in_end - c->in_begin,
+                         &used, &c->response);
+      c->in_begin += used;
+      if (result == ResponseParser::kError) {
+        Fail(c, c->parser.too_large() ? EMSGSIZE : EPROTO, kFailFirst);
+        return false;
+      }
+      if (result == ResponseParser::kNeedMore) break;
+      if (!CompleteFirst(c)) return false;
+    }
+    // Room has opened up: refill it, in one send for the whole batch.
+    if (!c->pool->waiting.empty()) Dispatch(c->pool);
+    return c->fd != -1;
+  }
+
+  // Delivers the parsed response to the first request in flight.
+  // Returns false if the connection is gone.
+  bool CompleteFirst(Connection *c) {
+    std::unique_ptr<Request> request = std::move(c->inflight.front());
+    c->inflight.pop_front();
+    c->answered = true;
+    if (!c->response.keep_alive()) c->closing = true;
+    if (!c->inflight.empty())
+      c->parser.Reset(c->inflight.front()->method == "HEAD");
+    else
+      c->idle_since = detail::NowMs();
+    stats_.responses++;
+    Complete(request.get(), &c->response, 0);
+    if (c->fd == -1) return false;
+    if (c->closing) {
+      // Whatever was pipelined behind this response was never answered.
+      if (c->inflight.empty())
+        Close(c);
+      else
+        Fail(c, ECONNRESET, kRetryAll);
+      return false;
+    }
+    return true;
+  }
+
+  void Complete(Request *request, const Response *response, int error) {
+    outstanding_--;
+    if (error != 0) stats_.errors++;
+    if (request->callback) request->callback(response, error);
+  }
+
+  // Removes `c` from its pool; it is freed at the end of Poll().
+  void Detach(Connection *c) {
+    if (c->fd != -1) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, nullptr);
+      close(c->fd);
+      c->fd = -1;
+    }
+    auto &list = c->pool->connections;
+    for (auto it = list.begin(); it != list.end(); ++it) {
+      if (it->get() == c) {
+        graveyard_.push_back(std::move(*it));
+        list.erase(it);
+        break;
+      }
+    }
+  }
+
+  void Close(Connection *c) {
+    Pool *pool = c->pool;
+    Detach(c);
+    Dispatch(pool);
+  }
+
+  void Fail(Connection *c, int error, Disposal disposal) {
+    Pool *pool = c->pool;
+    std::deque<std::unique_ptr<Request>> inflight;
+    inflight.swap(c->inflight);
+    Detach(c);
+    std::vector<std::unique_ptr<Request>> failed;
+    for (size_t i = inflight.size(); i-- > 0;) {
+      std::unique_ptr<Request> &r = inflight[i];
+      bool retry = disposal == kRetryAll || (disposal == kFailFirst && i > 0);
+      if (retry && r->retries == 0 && Idempotent(r->method)) {
+        r->retries++;
+        stats_.retries++;
+        pool->waiting.push_front(std::move(r));
+      } else {
+        failed.push_back(std::move(r));
+      }
+    }
+    Dispatch(pool);
+    for (auto it = failed.rbegin(); it != failed.rend(); ++it)
+      Complete(it->get(), nullptr, error);
+  }
+
+  // Times out requests and closes idle connections.
+  void Sweep() {
+    uint64_t now = detail::NowMs();
+    next_sweep_ = now + kSweepMs;
+    std::vector<Pool *> pools;
+    for (auto &entry : pools_) pools.push_back(entry.second.get());
+    for (Pool *pool : pools) {
+      std::vector<Connection *> connections;
+      for (auto &c : pool->connections) connections.push_back(c.get());
+      for (Connection *c : connections) {
+        if (c->fd == -1) continue;  // failed during this sweep
+        if (!c->inflight.empty()) {
+          if (c->inflight.front()->deadline <= now)
+            Fail(c, ETIMEDOUT, c->connecting ? kFailAll : kFailFirst);
+        } else if (now - c->idle_since >= uint64_t(options_.idle_timeout_ms)) {
+          Close(c);
+        }
+      }
+      while (!pool->waiting.empty() && pool->waiting.front()->deadline <= now) {
+        std::unique_ptr<Request> r = std::move(pool->waiting.front());
+        pool->waiting.pop_front();
+        Complete(r.get(), nullptr, ETIMEDOUT);
+      }
+    }
+  }
+
+  Options options_;
+  Resolver resolver_;
+  int epoll_fd_;
+  std::unordered_map<std::string, std::unique_ptr<Pool>> pools_;
+  std::vector<std::unique_ptr<Connection>> graveyard_;
+  size_t outstanding_ = 0;
+  uint64_t next_sweep_ = 0;
+  Stats stats_ = {};
+};
+
+}  // namespace http
+
+#endif  // NETWORK_HTTP_HTTP_CLIENT_H_
@@ -0,0 +1,413 @@
+#ifndef NETWORK_LOCAL_LOCAL_CHANNEL_H_
+#define NETWORK_LOCAL_LOCAL_CHANNEL_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Local message channel over an AF_UNIX SOCK_SEQPACKET socket.
+//
+// Small messages travel inline, copied through the socket like the client
+// and server in Readme 4.2.3.  Large ones are written once into a memfd,
+// sealed against modification and passed as a descriptor (SCM_RIGHTS); the
+// receiver maps it read-only, so the body itself is never copied by the
+// kernel.  Functions follow the system call convention: -1 and errno on
+// failure.
+namespace local {
+
+struct FrameHeader {
+  uint32_t kind;  // kInline or kMemfd
+  uint32_t reserved;
+  uint64_t size;
+};
+
+constexpr uint32_t kInline = 1;
+constexpr uint32_t kMemfd = 2;
+constexpr unsigned int kRequiredSeals =
+    F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+// A received message.  Inline bodies point into the channel's receive
+// buffer and stay valid until the next receive; memfd bodies own their
+// mapping.
+class Message {
+ public:
+  Message() = default;
+  Message(const Message &) = delete;
+  Message &operator=(const Message &) = delete;
+  Message(Message &&other) { *this = std::move(other); }
+  Message &operator=(Message &&other) {
+    if (this != &other) {
+      Release();
+      data_ = other.data_;
+      size_ = other.size_;
+      map_ = other.map_;
+      other.map_ = nullptr;
+    }
+    return *this;
+  }
+  ~Message() { Release(); }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool mapped() const { return map_ != nullptr; }
+  std::string_view view() const { return std::string_view(data_, size_); }
+
+ private:
+  friend class Channel;
+
+  void Release() {
+    if (map_ != nullptr) munmap(map_, size_);
+    map_ = nullptr;
+  }
+
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  void *map_ = nullptr;
+};
+
+// Writable memfd-backed buffer for a large outgoing message.  The producer
+// fills data() in place; Channel::Send() then seals and passes it.
+class Payload {
+ public:
+  Payload() = default;
+  Payload(const Payload &) = delete;
+  Payload &operator=(const Payload &) = delete;
+  Payload(Payload &&other)
+      : fd_(other.fd_), data_(other.data_), size_(other.size_) {
+    other.fd_ = -1;
+    other.data_ = nullptr;
+  }
+  ~Payload() { Reset(); }
+
+  // Returns 0 on success, -1 on failure.
+  int Allocate(size_t size) {
+    Reset();
+    fd_ = memfd_create("local_channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd_ == -1) return -1;
+    if (ftruncate(fd_, size) == -1) return Fail();
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, 0);
+    if (p == MAP_FAILED) return Fail();
+    data_ = static_cast<char *>(p);
+    size_ = size;
+    return 0;
+  }
+
+  char *data() { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  friend class Channel;
+
+  // Drops the writable mapping (F_SEAL_WRITE refuses while one exists) and
+  // seals the file.  Returns the descriptor to pass.
+  int Seal() {
+    munmap(data_, size_);
+    data_ = nullptr;
+    if (fcntl(fd_, F_ADD_SEALS, kRequiredSeals) == -1) return -1;
+    return fd_;
+  }
+
+  int Fail() {
+    int saved = errno;
+    Reset();
+    errno = saved;
+    return -1;
+  }
+
+  void Reset() {
+    if (data_ != nullptr) munmap(data_, size_);
+    if (fd_ != -1) close(fd_);
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  int fd_ = -1;
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+class Channel {
+ public:
+  // Messages larger than `inline_limit` bytes go through a memfd.
+  explicit Channel(int fd, size_t inline_limit = 64 << 10)
+      : fd_(fd), inline_limit_(inline_limit),
+        buf_(sizeof(FrameHeader) + inline_limit) {}
+  Channel(const Channel &) = delete;
+  Channel &operator=(const Channel &) = delete;
+  ~Channel() {
+    if (fd_ != -1) close(fd_);
+  }
+
+  // Connected pair, e.g. for a parent and its forked child.
+  static int Pair(int fds[2]) {
+    return socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+  }
+
+  static int Listen(const char *path, int backlog = 5) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    struct sockaddr_un name = MakeAddress(path);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&name), SUN_LEN(&name)) ==
+            -1 ||
+        listen(fd, backlog) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static int Connect(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    struct sockaddr_un name = MakeAddress(path);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&name),
+                SUN_LEN(&name)) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  int fd() const { return fd_; }
+  size_t inline_limit() const { return inline_limit_; }
+
+  // Sends inline when the body fits, otherwise copies it once into a memfd.
+  // Producers that can build the body in place should use Send(Payload&&).
+  int Send(const void *data, size_t size) {
+    if (size <= inline_limit_) return SendInline(data, size);
+    Payload payload;
+    if (payload.Allocate(size) == -1) return -1;
+    memcpy(payload.data(), data, size);
+    return Send(std::move(payload));
+  }
+
+  int Send(Payload &&payload) {
+    int memfd = payload.Seal();
+    if (memfd == -1) return -1;
+
+    FrameHeader header = {kMemfd, 0, payload.size()};
+    struct iovec iov = {&header, sizeof header};
+    union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    return SendMsg(&msg);
+  }
+
+  // Sends up to `count` small messages with one sendmmsg().  Returns how
+  // many were sent.  Every message must fit inline.
+  int SendBatch(const std::string_view *msgs, int count) {
+    constexpr int kMaxBatch = 64;
+    if (count > kMaxBatch) count = kMaxBatch;
+    FrameHeader headers[kMaxBatch];
+    struct iovec iov[kMaxBatch][2];
+    struct mmsghdr mmsg[kMaxBatch];
+    memset(mmsg, 0, sizeof(struct mmsghdr) * count);
+    for (int i = 0; i < count; i++) {
+      if (msgs[i].size() > inline_limit_) {
+        errno = EMSGSIZE;
+        return -1;
+      }
+      headers[i] = {kInline, 0, msgs[i].size()};
+      iov[i][0] = {&headers[i], sizeof(FrameHeader)};
+      iov[i][1] = {const_cast<char *>(msgs[i].data()), msgs[i].size()};
+      mmsg[i].msg_hdr.msg_iov = iov[i];
+      mmsg[i].msg_hdr.msg_iovlen = 2;
+    }
+    int sent;
+    do {
+      sent = sendmmsg(fd_, mmsg, count, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    return sent;
+  }
+
+  // Returns 1 and fills `out`, 0 when the peer closed, -1 on error.
+  int Recv(Message *out) {
+    union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    struct iovec iov = {buf_.data(), buf_.size()};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    ssize_t count;
+    do {
+      count = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+    } while (count == -1 && errno == EINTR);
+    if (count <= 0) return count;
+
+    return Decode(buf_.data(), count, msg.msg_flags, TakeFd(&msg), out);
+  }
+
+  // Receives up to `count` messages, inline or memfd, with one recvmmsg();
+  // blocks for the first only.  Returns how many were stored in `out`, 0
+  // when the peer closed, -1 on error.  A malformed frame is dropped and
+  // counted in `*rejected` without losing the rest of the batch; when
+  // every frame was malformed the result is -1 with errno EBADMSG.
+  int RecvBatch(Message *out, int count, int *rejected = nullptr) {
+    constexpr int kMaxBatch = 64;
+    if (count > kMaxBatch) count = kMaxBatch;
+    size_t slot = sizeof(FrameHeader) + inline_limit_;
+    if (batch_buf_.size() < slot * count) batch_buf_.resize(slot * count);
+
+    union Control {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } control[kMaxBatch];
+    struct iovec iov[kMaxBatch];
+    struct mmsghdr mmsg[kMaxBatch];
+    memset(mmsg, 0, sizeof(struct mmsghdr) * count);
+    for (int i = 0; i < count; i++) {
+      iov[i] = {batch_buf_.data() + slot * i, slot};
+      mmsg[i].msg_hdr.msg_iov = &iov[i];
+      mmsg[i].msg_hdr.msg_iovlen = 1;
+      mmsg[i].msg_hdr.msg_control = control[i].buf;
+      mmsg[i].msg_hdr.msg_controllen = sizeof control[i].buf;
+    }
+    int received;
+    do {
+      received = recvmmsg(fd_, mmsg, count, MSG_WAITFORONE | MSG_CMSG_CLOEXEC,
+                          nullptr);
+    } while (received == -1 && errno == EINTR);
+    if (rejected != nullptr) *rejected = 0;
+    if (received <= 0) return received;
+
+    // Every frame is already off the socket, so a bad one is skipped
+    // rather than taking the good ones down with it.
+    int good = 0;
+    for (int i = 0; i < received; i++) {
+      if (Decode(static_cast<char *>(iov[i].iov_base), mmsg[i].msg_len,
+                 mmsg[i].msg_hdr.msg_flags, TakeFd(&mmsg[i].msg_hdr),
+                 &out[good]) == 1)
+        good++;
+      else if (rejected != nullptr)
+        ++*rejected;
+    }
+    if (good == 0) errno = EBADMSG;
+    return good > 0 ? good : -1;
+  }
+
+ private:
+  static struct sockaddr_un MakeAddress(const char *path) {
+    struct sockaddr_un name;
+    memset(&name, 0, sizeof name);
+    name.sun_family = AF_UNIX;
+    strncpy(name.sun_path, path, sizeof name.sun_path - 1);
+    return name;
+  }
+
+  // The descriptor passed with a received message, or -1.
+  static int TakeFd(struct msghdr *msg) {
+    int fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return fd;
+  }
+
+  int SendInline(const void *data, size_t size) {
+    FrameHeader header = {kInline, 0, size};
+    struct iovec iov[2] = {{&header, sizeof header},
+                           {const_cast<void *>(data), size}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    return SendMsg(&msg);
+  }
+
+  int SendMsg(struct msghdr *msg) {
+    ssize_t count;
+    do {
+      count = sendmsg(fd_, msg, MSG_NOSIGNAL);
+    } while (count == -1 && errno == EINTR);
+    return count == -1 ? -1 : 0;
+  }
+
+  // Validates one received frame and, for memfd frames, maps the body.
+  // Takes ownership of `memfd`.
+  static int Decode(char *frame, size_t count, int flags, int memfd,
+                    Message *out) {
+    FrameHeader header;
+    if ((flags & (MSG_TRUNC | MSG_CTRUNC)) || count < sizeof header)
+      return Reject(memfd, EBADMSG);
+    memcpy(&header, frame, sizeof header);
+
+    if (header.kind == kInline) {
+      if (memfd != -1 || header.size != count - sizeof header)
+        return Reject(memfd, EBADMSG);
+      *out = Message();
+      out->data_ = frame + sizeof header;
+      out->size_ = header.size;
+      return 1;
+    }
+
+    // The sender cannot change a sealed memfd under us, so the mapping is
+    // safe to read without copying it first.
+    if (header.kind != kMemfd || memfd == -1) return Reject(memfd, EBADMSG);
+    int seals = fcntl(memfd, F_GET_SEALS);
+    struct stat st;
+    if (seals == -1 || (seals & kRequiredSeals) != kRequiredSeals ||
+        fstat(memfd, &st) == -1 ||
+        static_cast<uint64_t>(st.st_size) != header.size)
+      return Reject(memfd, EBADMSG);
+
+    void *p = nullptr;
+    if (header.size > 0) {
+      p = mmap(nullptr, header.size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+               memfd, 0);
+      if (p == MAP_FAILED) return Reject(memfd, errno);
+    }
+    close(memfd);
+    *out = Message();
+    out->data_ = static_cast<const char *>(p);
+    out->size_ = header.size;
+    out->map_ = p;
+    return 1;
+  }
+
+  static int Reject(int memfd, int error) {
+    if (memfd != -1) close(memfd);
+    errno = error;
+    return -1;
+  }
+
+  int fd_;
+  size_t inline_limit_;
+  std::vector<char> buf_;
+  std::vector<char> batch_buf_;
+};
+
+}  // namespace local
+
+#endif  // NETWORK_LOCAL_LOCAL_CHANNEL_H_
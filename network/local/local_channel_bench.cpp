@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "local_channel.h"
+
+constexpr size_t kInlineLimit = 128 << 10;
+constexpr int kBatch = 32;
+constexpr int kSmallMessages = 200000;
+
+// Stands in for the receiver actually using the body.
+uint64_t Checksum(const char *data, size_t size) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof word);
+    sum += word;
+  }
+  return sum;
+}
+
+bool ReadFully(int fd, void *buf, size_t size) {
+  char *p = static_cast<char *>(buf);
+  while (size > 0) {
+    ssize_t count = read(fd, p, size);
+    if (count <= 0) return false;
+    p += count;
+    size -= count;
+  }
+  return true;
+}
+
+bool WriteFully(int fd, const void *buf, size_t size) {
+  const char *p = static_cast<const char *>(buf);
+  while (size > 0) {
+    ssize_t count = write(fd, p, size);
+    if (count <= 0) return false;
+    p += count;
+    size -= count;
+  }
+  return true;
+}
+
+// Baseline: length prefix and body copied through a stream socket, as
+// SendMsg() and Serve() do in Readme 4.2.3.
+void StreamServe(int fd) {
+  std::vector<char> body;
+  uint64_t size;
+  volatile uint64_t sink = 0;
+  while (ReadFully(fd, &size, sizeof size)) {
+    body.resize(size);
+    if (!ReadFully(fd, body.data(), size)) break;
+    sink += Checksum(body.data(), size);
+    char ack = 0;
+    write(fd, &ack, 1);
+  }
+}
+
+void ChannelServe(int fd) {
+  local::Channel channel(fd, kInlineLimit);
+  local::Message msg;
+  volatile uint64_t sink = 0;
+  while (channel.Recv(&msg) == 1) {
+    sink += Checksum(msg.data(), msg.size());
+    char ack = 0;
+    channel.Send(&ack, 1);
+  }
+}
+
+void BatchServe(int fd) {
+  local::Channel channel(fd, kInlineLimit);
+  local::Message msgs[kBatch];
+  int received = 0, count;
+  while (received < kSmallMessages &&
+         (count = channel.RecvBatch(msgs, kBatch)) > 0)
+    received += count;
+  char ack = 0;
+  channel.Send(&ack, 1);
+}
+
+template <typename Serve>
+pid_t Spawn(int type, Serve serve, int *fd) {
+  int fds[2];
+  socketpair(AF_UNIX, type, 0, fds);
+  pid_t child_pid = fork();
+  if (child_pid == 0) {
+    close(fds[0]);
+    serve(fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+  *fd = fds[0];
+  return child_pid;
+}
+
+struct Stat {
+  double us_per_msg;
+  double mb_per_s;
+};
+
+template <typename F>
+Stat Measure(size_t size, int iterations, F &&send_one) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) send_one();
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double us = elapsed.count() / iterations;
+  return {us, size / us};
+}
+
+Stat StreamPath(size_t size, int iterations) {
+  int fd;
+  pid_t child_pid = Spawn(SOCK_STREAM, &StreamServe, &fd);
+  std::vector<char> body(size);
+  Stat stat = Measure(size, iterations, [&] {
+    memset(body.data(), 'x', size);  // the producer writes its payload
+    uint64_t length = size;
+    WriteFully(fd, &length, sizeof length);
+    WriteFully(fd, body.data(), size);
+    char ack;
+    read(fd, &ack, 1);
+  });
+  close(fd);
+  waitpid(child_pid, nullptr, 0);
+  return stat;
+}
+
+Stat ChannelPath(size_t size, int iterations, bool use_memfd) {
+  int fd;
+  pid_t child_pid = Spawn(SOCK_SEQPACKET, &ChannelServe, &fd);
+  Stat stat;
+  {
+    local::Channel channel(fd, kInlineLimit);
+    local::Message ack;
+    std::vector<char> body(size);
+    stat = Measure(size, iterations, [&] {
+      if (use_memfd) {
+        local::Payload payload;
+        payload.Allocate(size);
+        memset(payload.data(), 'x', size);
+        channel.Send(std::move(payload));
+      } else {
+        memset(body.data(), 'x', size);
+        channel.Send(body.data(), size);
+      }
+      channel.Recv(&ack);
+    });
+  }  // closes the channel so the child sees EOF
+  waitpid(child_pid, nullptr, 0);
+  return stat;
+}
+
+double SmallMessages(bool batched) {
+  int fd;
+  pid_t child_pid =
+      batched ? Spawn(SOCK_SEQPACKET, &BatchServe, &fd)
+              : Spawn(SOCK_SEQPACKET, &ChannelServe, &fd);
+  double elapsed;
+  {
+    local::Channel channel(fd, kInlineLimit);
+    char body[64];
+    memset(body, 'x', sizeof body);
+
+    auto start = std::chrono::steady_clock::now();
+    local::Message ack;
+    if (batched) {
+      std::string_view msgs[kBatch];
+      for (auto &m : msgs) m = std::string_view(body, sizeof body);
+      for (int sent = 0; sent < kSmallMessages;) {
+        int count = channel.SendBatch(msgs, kBatch);
+        if (count <= 0) break;
+        sent += count;
+      }
+      channel.Recv(&ack);
+    } else {
+      // ChannelServe acks every message, so keep kBatch of them in flight.
+      for (int sent = 0; sent < kSmallMessages; sent += kBatch) {
+        for (int i = 0; i < kBatch; i++) channel.Send(body, sizeof body);
+        for (int i = 0; i < kBatch; i++) channel.Recv(&ack);
+      }
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start).count();
+  }
+  waitpid(child_pid, nullptr, 0);
+  return kSmallMessages / elapsed;
+}
+
+// One recvmmsg() batch holding inline and memfd messages and a malformed
+// frame: the good ones come back in order, the bad one is counted.
+bool MixedBatch() {
+  int fds[2];
+  if (local::Channel::Pair(fds) == -1) return false;
+  local::Channel tx(fds[0], kInlineLimit), rx(fds[1], kInlineLimit);
+  std::vector<char> big(1 << 20, 'm');
+  tx.Send("a", 1);
+  tx.Send(big.data(), big.size());
+  tx.Send("b", 1);
+  send(tx.fd(), "bad", 3, 0);  // shorter than a FrameHeader
+  tx.Send("c", 1);
+
+  local::Message msgs[8];
+  int rejected;
+  int count = rx.RecvBatch(msgs, 8, &rejected);
+  std::string_view whole(big.data(), big.size());
+  return count == 4 && rejected == 1 && msgs[0].view() == "a" &&
+         msgs[1].mapped() && msgs[1].view() == whole &&
+         msgs[2].view() == "b" && msgs[3].view() == "c";
+}
+
+int main() {
+  if (!MixedBatch()) {
+    fprintf(stderr, "mixed inline/memfd batch: FAILED\n");
+    return 1;
+  }
+  const size_t sizes[] = {64,        1 << 10,   16 << 10, 64 << 10, 128 << 10,
+                          256 << 10, 1 << 20,   4 << 20,  16 << 20, 64 << 20};
+
+  printf("%10s | %21s | %21s | %21s\n", "", "stream copy", "channel inline",
+         "channel memfd");
+  printf("%10s | %10s %10s | %10s %10s | %10s %10s\n", "size", "us/msg",
+         "MB/s", "us/msg", "MB/s", "us/msg", "MB/s");
+  for (size_t size : sizes) {
+    int iterations = (256 << 20) / size;
+    if (iterations > 20000) iterations = 20000;
+    if (iterations < 20) iterations = 20;
+
+    Stat stream = StreamPath(size, iterations);
+    printf("%10zu | %10.1f %10.1f |", size, stream.us_per_msg,
+           stream.mb_per_s);
+    if (size <= kInlineLimit) {
+      Stat in = ChannelPath(size, iterations, false);
+      printf(" %10.1f %10.1f |", in.us_per_msg, in.mb_per_s);
+    } else {
+      printf(" %10s %10s |", "-", "-");
+    }
+    Stat fd = ChannelPath(size, iterations, true);
+    printf(" %10.1f %10.1f\n", fd.us_per_msg, fd.mb_per_s);
+  }
+
+  printf("\n64-byte messages: %.0f msg/s one by one, %.0f msg/s batched by %d\n",
+         SmallMessages(false), SmallMessages(true), kBatch);
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+#include "timing_wheel.h"
+
+constexpr int kTimers = 1000000;
+constexpr uint64_t kSpan = 60000;  // ticks, i.e. one minute at 1 ms
+
+uint64_t late_fires = 0;  // fired at a tick other than the one asked for
+uint64_t current_tick = 0;
+
+void OnExpire(timer::Timer *t) {
+  if (t->expires != current_tick) late_fires++;
+}
+
+double NsSince(std::chrono::steady_clock::time_point start, int ops) {
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ops;
+}
+
+void BenchWheel(const std::vector<uint64_t> &deadlines) {
+  std::vector<timer::Timer> timers(kTimers);
+  timer::TimingWheel wheel;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kTimers; i++) {
+    timers[i].callback = &OnExpire;
+    wheel.Add(&timers[i], deadlines[i]);
+  }
+  double insert = NsSince(start, kTimers);
+
+  // Most connection timeouts are cancelled before they fire.
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kTimers; i += 2) wheel.Cancel(&timers[i]);
+  double cancel = NsSince(start, kTimers / 2);
+
+  size_t fired = 0;
+  start = std::chrono::steady_clock::now();
+  for (current_tick = 0; current_tick <= kSpan; current_tick++)
+    fired += wheel.Advance(current_tick);
+  double expire = NsSince(start, fired);
+
+  printf("%-16s %10.1f %10.1f %10.1f   fired %zu, late %lu\n", "timing wheel",
+         insert, cancel, expire, fired, late_fires);
+}
+
+// Baseline: binary heap with lazy cancellation, the usual priority_queue
+// approach since it cannot remove arbitrary entries.
+void BenchHeap(const std::vector<uint64_t> &deadlines) {
+  using Entry = std::pair<uint64_t, int>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  std::vector<bool> cancelled(kTimers, false);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kTimers; i++) heap.push({deadlines[i], i});
+  double insert = NsSince(start, kTimers);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kTimers; i += 2) cancelled[i] = true;
+  double cancel = NsSince(start, kTimers / 2);
+
+  size_t fired = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint64_t tick = 0; tick <= kSpan; tick++) {
+    while (!heap.empty() && heap.top().first <= tick) {
+      if (!cancelled[heap.top().second]) fired++;
+      heap.pop();
+    }
+  }
+  double expire = NsSince(start, fired);
+
+  printf("%-16s %10.1f %10.1f %10.1f   fired %zu\n", "priority_queue",
+         insert, cancel, expire, fired);
+}
+
+// A few timers on a real event loop: one timerfd registered with epoll.
+void EpollDemo() {
+  timer::TimerScheduler scheduler(1000000, 5);  // 1 ms ticks, 5 ms slack
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, scheduler.fd(), &ev);
+
+  static auto start = std::chrono::steady_clock::now();
+  timer::Timer timers[5];
+  const uint64_t delays[] = {11, 12, 14, 31, 33};
+  for (int i = 0; i < 5; i++) {
+    timers[i].data = reinterpret_cast<void *>(delays[i]);
+    timers[i].callback = [](timer::Timer *t) {
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      printf("  timer for %3lu ms fired at %6.2f ms\n",
+             reinterpret_cast<uint64_t>(t->data), elapsed.count());
+    };
+    scheduler.Add(&timers[i], delays[i]);
+  }
+
+  int wakeups = 0;
+  while (scheduler.size() > 0) {
+    if (epoll_wait(epoll_fd, &ev, 1, -1) == 1) {
+      scheduler.Dispatch();
+      wakeups++;
+    }
+  }
+  printf("  %d epoll wakeups for 5 timers\n\n", wakeups);
+  close(epoll_fd);
+}
+
+int main() {
+  std::cout << "Epoll-driven scheduler:\n";
+  EpollDemo();
+
+  std::vector<uint64_t> deadlines(kTimers);
+  unsigned seed = 1;
+  for (auto &d : deadlines) d = 1 + rand_r(&seed) % kSpan;
+
+  std::cout << kTimers << " live timers over " << kSpan << " ticks:\n";
+  printf("%-16s %10s %10s %10s\n", "", "insert ns", "cancel ns", "expire ns");
+  BenchWheel(deadlines);
+  BenchHeap(deadlines);
+  return late_fires == 0 ? 0 : 1;
+}
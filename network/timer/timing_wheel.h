@@ -0,0 +1,305 @@
+#ifndef NETWORK_TIMER_TIMING_WHEEL_H_
+#define NETWORK_TIMER_TIMING_WHEEL_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstddef>
+
+// Hierarchical timing wheel for large timeout populations.
+//
+// Timers are intrusive: a connection or request embeds a Timer, so adding
+// and cancelling never allocate and both are O(1).  The wheel has a 256-slot
+// root level of single ticks and four 64-slot levels above it, covering 2^32
+// ticks; timers further out are clamped to the last slot.  Like the kernel's
+// classic timer wheel, higher levels are cascaded down when the root wraps.
+//
+// Not thread-safe: each event-loop thread owns its wheel.
+namespace timer {
+
+struct Timer;
+using Callback = void (*)(Timer *timer);
+
+struct Timer {
+  Timer *prev = nullptr;
+  Timer *next = nullptr;
+  uint64_t expires = 0;  // absolute tick
+  uint32_t slot = 0;
+  Callback callback = nullptr;
+  void *data = nullptr;
+
+  bool pending() const { return prev != nullptr; }
+};
+
+class TimingWheel {
+ public:
+  static constexpr int kRootBits = 8;
+  static constexpr int kLevelBits = 6;
+  static constexpr int kLevels = 4;  // above the root
+  static constexpr uint32_t kRootSize = 1u << kRootBits;
+  static constexpr uint32_t kLevelSize = 1u << kLevelBits;
+  static constexpr uint64_t kMaxDelta =
+      (1ull << (kRootBits + kLevels * kLevelBits)) - 1;
+  static constexpr uint64_t kNever = ~0ull;
+
+  explicit TimingWheel(uint64_t now = 0) : now_(now) {
+    for (auto &head : heads_) head.prev = head.next = &head;
+    memset(root_bits_, 0, sizeof root_bits_);
+    memset(level_bits_, 0, sizeof level_bits_);
+  }
+  TimingWheel(const TimingWheel &) = delete;
+  TimingWheel &operator=(const TimingWheel &) = delete;
+
+  uint64_t now() const { return now_; }
+  size_t size() const { return size_; }
+
+  // Schedules `t` to fire at tick `expires`; past ticks fire on the next
+  // Advance().  A pending timer is moved.
+  void Add(Timer *t, uint64_t expires) {
+    if (t->pending()) Cancel(t);
+    if (expires < now_) expires = now_;
+    if (expires - now_ > kMaxDelta) expires = now_ + kMaxDelta;
+    t->expires = expires;
+    Place(t);
+    size_++;
+  }
+
+  void Cancel(Timer *t) {
+    if (!t->pending()) return;
+    Unlink(t);
+    size_--;
+  }
+
+  // Fires every timer due at or before tick `target`, in tick order.
+  // Callbacks may add or cancel timers, including themselves.  Returns the
+  // number fired.
+  size_t Advance(uint64_t target) {
+    size_t fired = 0;
+    Timer expired;
+    expired.prev = expired.next = &expired;
+
+    while (now_ <= target) {
+      uint32_t index = now_ & (kRootSize - 1);
+      if (index == 0) Cascade();
+
+      if (size_ == 0) {
+        now_ = target + 1;
+        break;
+      }
+
+      // Skip empty root slots up to the next cascade or the target.
+      uint64_t next = NextRootSlot(index);
+      if (next == kRootSize) {
+        uint64_t boundary = (now_ | (kRootSize - 1)) + 1;
+        now_ = boundary <= target ? boundary : target + 1;
+        continue;
+      }
+      if (now_ + (next - index) > target) {
+        now_ = target + 1;
+        break;
+      }
+      now_ += next - index;
+
+      Timer *head = &heads_[now_ & (kRootSize - 1)];
+      while (head->next != head) {
+        Timer *t = head->next;
+        Unlink(t);
+        t->slot = kExpiredSlot;
+        Link(&expired, t);
+      }
+      ClearRootBit(now_ & (kRootSize - 1));
+      now_++;
+
+      // Expired timers stay linked on a private list until fired, so a
+      // callback can still cancel one that is due in the same batch.
+      while (expired.next != &expired) {
+        Timer *t = expired.next;
+        Unlink(t);
+        size_--;
+        fired++;
+        t->callback(t);
+      }
+    }
+    return fired;
+  }
+
+  // Earliest tick at which Advance() may have work: the next occupied root
+  // slot, or the next cascade.  kNever if the wheel is empty.
+  uint64_t NextExpiry() const {
+    if (size_ == 0) return kNever;
+    uint32_t index = now_ & (kRootSize - 1);
+    uint64_t next = NextRootSlot(index);
+    if (next != kRootSize) return now_ + (next - index);
+    return (now_ | (kRootSize - 1)) + 1;
+  }
+
+ private:
+  static constexpr uint32_t kSlots = kRootSize + kLevels * kLevelSize;
+  static constexpr uint32_t kExpiredSlot = kSlots;
+
+  void Place(Timer *t) {
+    uint64_t delta = t->expires - now_;
+    uint32_t slot;
+    if (delta < kRootSize) {
+      slot = t->expires & (kRootSize - 1);
+      root_bits_[slot >> 6] |= 1ull << (slot & 63);
+    } else {
+      int level = 0;
+      while (level < kLevels - 1 &&
+             delta >= 1ull << (kRootBits + (level + 1) * kLevelBits))
+        level++;
+      uint32_t index =
+          (t->expires >> (kRootBits + level * kLevelBits)) & (kLevelSize - 1);
+      slot = kRootSize + level * kLevelSize + index;
+      level_bits_[level] |= 1ull << index;
+    }
+    t->slot = slot;
+    Link(&heads_[slot], t);
+  }
+
+  // Re-places the timers of the level slots that the root has just reached.
+  void Cascade() {
+    for (int level = 0; level < kLevels; level++) {
+      uint32_t index =
+          (now_ >> (kRootBits + level * kLevelBits)) & (kLevelSize - 1);
+      Timer *head = &heads_[kRootSize + level * kLevelSize + index];
+      if (level_bits_[level] & (1ull << index)) {
+        level_bits_[level] &= ~(1ull << index);
+        Timer list;
+        list.prev = list.next = &list;
+        if (head->next != head) {
+          list.next = head->next;
+          list.prev = head->prev;
+          list.next->prev = list.prev->next = &list;
+          head->prev = head->next = head;
+        }
+        while (list.next != &list) {
+          Timer *t = list.next;
+          list.next = t->next;
+          t->next->prev = &list;
+          Place(t);
+        }
+      }
+      if (index != 0) break;
+    }
+  }
+
+  uint32_t NextRootSlot(uint32_t from) const {
+    for (uint32_t word = from >> 6; word < kRootSize / 64; word++) {
+      uint64_t bits = root_bits_[word];
+      if (word == from >> 6) bits &= ~0ull << (from & 63);
+      if (bits) return word * 64 + __builtin_ctzll(bits);
+    }
+    return kRootSize;
+  }
+
+  void ClearRootBit(uint32_t slot) {
+    root_bits_[slot >> 6] &= ~(1ull << (slot & 63));
+  }
+
+  static void Link(Timer *head, Timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+  }
+
+  void Unlink(Timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    Timer *next = t->next;
+    t->prev = t->next = nullptr;
+
+    uint32_t slot = t->slot;
+    if (slot == kExpiredSlot || next != next->next) return;
+    // `next` is the slot's head and the slot is now empty.
+    if (slot < kRootSize) {
+      ClearRootBit(slot);
+    } else {
+      uint32_t level = (slot - kRootSize) / kLevelSize;
+      level_bits_[level] &= ~(1ull << ((slot - kRootSize) % kLevelSize));
+    }
+  }
+
+  Timer heads_[kSlots];
+  uint64_t root_bits_[kRootSize / 64];
+  uint64_t level_bits_[kLevels];
+  uint64_t now_;
+  size_t size_ = 0;
+};
+
+// Drives a TimingWheel from one timerfd, for use with epoll: register fd()
+// for EPOLLIN and call Dispatch() when it is readable.  The timerfd is armed
+// only for the earliest pending tick, rounded up to `slack` ticks so nearby
+// deadlines expire as one batch.
+class TimerScheduler {
+ public:
+  explicit TimerScheduler(uint64_t tick_ns = 1000000, uint64_t slack = 1)
+      : tick_ns_(tick_ns), slack_(slack ? slack : 1), start_ns_(MonotonicNs()),
+        wheel_(0) {
+    fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  }
+  TimerScheduler(const TimerScheduler &) = delete;
+  TimerScheduler &operator=(const TimerScheduler &) = delete;
+  ~TimerScheduler() {
+    if (fd_ != -1) close(fd_);
+  }
+
+  // -1 if timerfd_create() failed.
+  int fd() const { return fd_; }
+  size_t size() const { return wheel_.size(); }
+
+  uint64_t NowTick() const { return (MonotonicNs() - start_ns_) / tick_ns_; }
+
+  void Add(Timer *t, uint64_t delay_ticks) {
+    wheel_.Add(t, NowTick() + delay_ticks);
+    if (t->expires < armed_) Arm(t->expires);
+  }
+
+  void Cancel(Timer *t) { wheel_.Cancel(t); }
+
+  // Fires due timers and re-arms the timerfd.  Returns the number fired.
+  size_t Dispatch() {
+    uint64_t expirations;
+    while (read(fd_, &expirations, sizeof expirations) > 0) {
+    }
+    armed_ = TimingWheel::kNever;
+    size_t fired = wheel_.Advance(NowTick());
+    uint64_t next = wheel_.NextExpiry();
+    if (next != TimingWheel::kNever && next < armed_) Arm(next);
+    return fired;
+  }
+
+ private:
+  static uint64_t MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  void Arm(uint64_t tick) {
+    tick = (tick + slack_ - 1) / slack_ * slack_;
+    // A zero it_value would disarm the timer, so never arm at start_ns_.
+    uint64_t ns = start_ns_ + (tick ? tick : 1) * tick_ns_;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    spec.it_value.tv_sec = ns / 1000000000ull;
+    spec.it_value.tv_nsec = ns % 1000000000ull;
+    timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    armed_ = tick;
+  }
+
+  int fd_;
+  uint64_t tick_ns_;
+  uint64_t slack_;
+  uint64_t start_ns_;
+  uint64_t armed_ = TimingWheel::kNever;
+  TimingWheel wheel_;
+};
+
+}  // namespace timer
+
+#endif  // NETWORK_TIMER_TIMING_WHEEL_H_
@@ -0,0 +1,339 @@
+#ifndef PROCESS_COMMUNICATION_MESSAGE_FLAT_MESSAGE_H_
+#define PROCESS_COMMUNICATION_MESSAGE_FLAT_MESSAGE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+// Flat binary messages that are read in place, without a parsing step.
+//
+// A message type is a plain struct that names, versions and describes
+// itself:
+//
+//   struct Greeting {
+//     static constexpr char kName[] = "Greeting";
+//     static constexpr uint16_t kVersion = 1;
+//     int32_t no;
+//     flat::Bytes text;  // variable-length tail
+//
+//     static constexpr auto Fields() {
+//       return flat::MakeFields(FLAT_FIELD(Greeting, no),
+//                               FLAT_FIELD(Greeting, text));
+//     }
+//   };
+//
+// On the wire a message is a Header, the struct itself and then the
+// variable-length tails, each padded to kAlign.  Any buffer holding those
+// bytes (a pipe read buffer, shared memory, an mmap'd file) can be opened
+// with View<T> and its fields used directly.
+//
+// The field list is hashed at compile time (each field's name, offset,
+// size and type code, plus sizeof(T)) into the header, so a receiver
+// built against a different layout gets kWrongLayout even when the
+// struct size is unchanged, e.g. after two fields swap places.  kVersion
+// is for deliberate, announced changes; it need not be relied on to
+// catch accidental ones.
+namespace flat {
+
+constexpr uint32_t kMagic = 0x544c4631;  // "1FLT"
+constexpr size_t kAlign = 8;
+
+constexpr size_t AlignUp(size_t n) { return (n + kAlign - 1) & ~(kAlign - 1); }
+
+constexpr uint32_t Fnv1a(const char *s, uint32_t h = 2166136261u) {
+  return *s ? Fnv1a(s + 1, (h ^ static_cast<uint8_t>(*s)) * 16777619u) : h;
+}
+
+// Folds the four bytes of `v` into an Fnv1a hash.
+constexpr uint32_t Fnv1a(uint32_t v, uint32_t h) {
+  for (int i = 0; i < 4; i++) h = (h ^ ((v >> (8 * i)) & 0xff)) * 16777619u;
+  return h;
+}
+
+// Reference to a variable-length tail, relative to the start of the body.
+struct Bytes {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// One entry of a message's field list; see FLAT_FIELD.
+struct Field {
+  const char *name;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t type;  // TypeCode() of the field's type
+};
+
+// Identifies a field type by kind, size and, for arrays, extent, so a
+// retyped field changes the layout hash even at the same offset.
+template <typename F>
+constexpr uint32_t TypeCode() {
+  if constexpr (std::is_same<F, Bytes>::value) {
+    return 'B';
+  } else if constexpr (std::is_array<F>::value) {
+    return TypeCode<std::remove_extent_t<F>>() * 31 + std::extent<F>::value;
+  } else if constexpr (std::is_enum<F>::value) {
+    return TypeCode<std::underlying_type_t<F>>();
+  } else if constexpr (std::is_same<F, bool>::value) {
+    return 'b';
+  } else if constexpr (std::is_floating_point<F>::value) {
+    return 'f' << 8 | sizeof(F);
+  } else if constexpr (std::is_integral<F>::value) {
+    return (std::is_signed<F>::value ? 'i' : 'u') << 8 | sizeof(F);
+  } else {
+    static_assert(sizeof(F) == 0, "flat fields are scalars, arrays or Bytes");
+    return 0;
+  }
+}
+
+// One Field of T, for T::Fields().  offsetof needs T complete, hence a
+// function rather than a static array.
+#define FLAT_FIELD(T, field)                                  \
+  ::flat::Field{#field, offsetof(T, field), sizeof(T::field), \
+                ::flat::TypeCode<decltype(T::field)>()}
+
+template <typename... F>
+constexpr std::array<Field, sizeof...(F)> MakeFields(F... fields) {
+  return {{fields...}};
+}
+
+struct alignas(kAlign) Header {
+  uint32_t magic;
+  uint32_t type_id;    // Fnv1a(T::kName)
+  uint16_t version;    // T::kVersion
+  uint16_t reserved;
+  uint32_t body_size;  // sizeof(T)
+  uint32_t total_size;  // header, body and tails, padding included
+  uint32_t layout;     // Schema<T>::kLayout
+};
+static_assert(sizeof(Header) % kAlign == 0, "header breaks body alignment");
+
+template <typename T>
+struct Schema {
+  static_assert(std::is_trivially_copyable<T>::value &&
+                    std::is_standard_layout<T>::value,
+                "flat messages must be plain structs");
+  static_assert(alignof(T) <= kAlign, "over-aligned message type");
+
+  static constexpr uint32_t kTypeId = Fnv1a(T::kName);
+  static constexpr uint16_t kVersion = T::kVersion;
+  static constexpr size_t kBodySize = AlignUp(sizeof(T));
+
+  // Fields in declaration order, none overlapping or outside T.
+  static constexpr bool Ordered() {
+    constexpr auto fields = T::Fields();
+    uint32_t end = 0;
+    for (const Field &f : fields) {
+      if (f.offset < end) return false;
+      end = f.offset + f.size;
+    }
+    return end <= sizeof(T);
+  }
+  static_assert(Ordered(), "T::Fields() out of order or overlapping");
+
+  static constexpr uint32_t Layout() {
+    constexpr auto fields = T::Fields();
+    uint32_t h = Fnv1a(static_cast<uint32_t>(sizeof(T)), 2166136261u);
+    for (const Field &f : fields) {
+      h = Fnv1a(f.name, h);
+      h = Fnv1a(f.offset, h);
+      h = Fnv1a(f.size, h);
+      h = Fnv1a(f.type, h);
+    }
+    return h;
+  }
+  static constexpr uint32_t kLayout = Layout();
+};
+
+enum class Status {
+  kOk,
+  kTruncated,    // buffer shorter than the message claims
+  kBadMagic,
+  kWrongType,
+  kWrongVersion,
+  kWrongLayout,  // same name and version but different fields or size
+  kMisaligned,   // buffer not aligned for in-place access
+};
+
+inline const char *StatusName(Status status) {
+  switch (status) {
+    case Status::kOk: return "ok";
+    case Status::kTruncated: return "truncated";
+    case Status::kBadMagic: return "bad magic";
+    case Status::kWrongType: return "wrong type";
+    case Status::kWrongVersion: return "wrong version";
+    case Status::kWrongLayout: return "wrong layout";
+    case Status::kMisaligned: return "misaligned";
+  }
+  return "unknown";
+}
+
+// Peeks at the total message size, e.g. to frame messages on a stream.
+// Returns 0 if fewer than sizeof(Header) bytes are available.
+inline size_t MessageSize(const void *buf, size_t n) {
+  if (n < sizeof(Header)) return 0;
+  uint32_t total;
+  memcpy(&total, static_cast<const char *>(buf) + offsetof(Header, total_size),
+         sizeof total);
+  return total;
+}
+
+// Read-only, in-place view of a received message.
+template <typename T>
+class View {
+ public:
+  View() = default;
+
+  // Checks the header once; fixed fields are then used directly.
+  Status Open(const void *buf, size_t n) {
+    body_ = nullptr;
+    size_ = 0;
+    if (reinterpret_cast<uintptr_t>(buf) % kAlign) return Status::kMisaligned;
+    if (n < sizeof(Header)) return Status::kTruncated;
+
+    const Header *h = static_cast<const Header *>(buf);
+    if (h->magic != kMagic) return Status::kBadMagic;
+    if (h->type_id != Schema<T>::kTypeId) return Status::kWrongType;
+    if (h->version != Schema<T>::kVersion) return Status::kWrongVersion;
+    if (h->body_size != sizeof(T) || h->layout != Schema<T>::kLayout)
+      return Status::kWrongLayout;
+    if (h->total_size > n ||
+        h->total_size < sizeof(Header) + Schema<T>::kBodySize)
+      return Status::kTruncated;
+
+    body_ = reinterpret_cast<const T *>(h + 1);
+    size_ = h->total_size;
+    return Status::kOk;
+  }
+
+  const T *operator->() const { return body_; }
+  const T &operator*() const { return *body_; }
+
+  // Tails are bounds-checked on access; a reference pointing outside the
+  // message yields an empty view.
+  std::string_view operator[](const Bytes &ref) const {
+    if (body_ == nullptr) return std::string_view();
+    size_t limit = size_ - sizeof(Header);
+    if (ref.offset < Schema<T>::kBodySize || ref.offset > limit ||
+        ref.size > limit - ref.offset)
+      return std::string_view();
+    return std::string_view(reinterpret_cast<const char *>(body_) + ref.offset,
+                            ref.size);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  const T *body_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Builds a message without serialising it: the header and body live in the
+// builder, tails stay in the caller's memory until the message is written.
+// Tail data must outlive WriteTo()/CopyTo().
+template <typename T, int kMaxTails = 8>
+class Builder {
+ public:
+  Builder() {
+    memset(&storage_, 0, sizeof storage_);
+    storage_.header.magic = kMagic;
+    storage_.header.type_id = Schema<T>::kTypeId;
+    storage_.header.version = Schema<T>::kVersion;
+    storage_.header.body_size = sizeof(T);
+    storage_.header.layout = Schema<T>::kLayout;
+    storage_.header.total_size = sizeof(Header) + Schema<T>::kBodySize;
+    iov_[0] = {&storage_, sizeof(Header) + Schema<T>::kBodySize};
+    iovcnt_ = 1;
+  }
+
+  // iov_ points into storage_, so a copy would refer to the original.
+  Builder(const Builder &) = delete;
+  Builder &operator=(const Builder &) = delete;
+
+  T *operator->() { return &storage_.body; }
+  T &operator*() { return storage_.body; }
+
+  // Appends a tail and points `ref` at it.  Returns false when the builder
+  // has no room for more tails or the message would outgrow its 32-bit
+  // size and offset fields.
+  bool Set(Bytes T::*ref, const void *data, size_t n) {
+    if (iovcnt_ + 2 > kIovMax) return false;
+    if (n > UINT32_MAX - kAlign ||
+        AlignUp(n) > UINT32_MAX - storage_.header.total_size)
+      return false;
+    size_t offset = storage_.header.total_size - sizeof(Header);
+    storage_.body.*ref = Bytes{static_cast<uint32_t>(offset),
+                               static_cast<uint32_t>(n)};
+    iov_[iovcnt_++] = {const_cast<void *>(data), n};
+    size_t pad = AlignUp(n) - n;
+    if (pad) iov_[iovcnt_++] = {const_cast<char *>(kPadding), pad};
+    storage_.header.total_size += AlignUp(n);
+    return true;
+  }
+
+  bool Set(Bytes T::*ref, std::string_view s) {
+    return Set(ref, s.data(), s.size());
+  }
+
+  size_t size() const { return storage_.header.total_size; }
+
+  // Gathers header, body and tails with writev(), resuming after short
+  // writes.  Returns false on error with errno set.
+  bool WriteTo(int fd) {
+    struct iovec iov[kIovMax];
+    memcpy(iov, iov_, sizeof(struct iovec) * iovcnt_);
+    struct iovec *next = iov;
+    int left = iovcnt_;
+    while (left > 0) {
+      ssize_t count = writev(fd, next, left);
+      if (count == -1) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      while (left > 0 && static_cast<size_t>(count) >= next->iov_len) {
+        count -= next->iov_len;
+        next++;
+        left--;
+      }
+      if (left > 0) {
+        next->iov_base = static_cast<char *>(next->iov_base) + count;
+        next->iov_len -= count;
+      }
+    }
+    return true;
+  }
+
+  // Copies the message into a transport buffer (shared memory, a mapped
+  // file).  Returns the bytes written, or 0 if it does not fit.
+  size_t CopyTo(void *buf, size_t n) const {
+    if (n < size()) return 0;
+    char *out = static_cast<char *>(buf);
+    for (int i = 0; i < iovcnt_; i++) {
+      memcpy(out, iov_[i].iov_base, iov_[i].iov_len);
+      out += iov_[i].iov_len;
+    }
+    return size();
+  }
+
+ private:
+  static constexpr int kIovMax = 1 + 2 * kMaxTails;
+  static constexpr char kPadding[kAlign] = {};
+
+  struct alignas(kAlign) Storage {
+    Header header;
+    T body;
+  } storage_;
+  struct iovec iov_[kIovMax];
+  int iovcnt_;
+};
+
+}  // namespace flat
+
+#endif  // PROCESS_COMMUNICATION_MESSAGE_FLAT_MESSAGE_H_
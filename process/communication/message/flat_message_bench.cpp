@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "flat_message.h"
+
+struct Order {
+  static constexpr char kName[] = "Order";
+  static constexpr uint16_t kVersion = 1;
+
+  int32_t no;
+  int32_t quantity;
+  int64_t timestamp;
+  double price;
+  flat::Bytes symbol;
+  flat::Bytes note;
+
+  static constexpr auto Fields() {
+    return flat::MakeFields(
+        FLAT_FIELD(Order, no), FLAT_FIELD(Order, quantity),
+        FLAT_FIELD(Order, timestamp), FLAT_FIELD(Order, price),
+        FLAT_FIELD(Order, symbol), FLAT_FIELD(Order, note));
+  }
+};
+
+// Order as an older build declared it: same name, version and size, with
+// the two int32 fields the other way round.
+struct OrderSwapped {
+  static constexpr char kName[] = "Order";
+  static constexpr uint16_t kVersion = 1;
+
+  int32_t quantity;
+  int32_t no;
+  int64_t timestamp;
+  double price;
+  flat::Bytes symbol;
+  flat::Bytes note;
+
+  static constexpr auto Fields() {
+    return flat::MakeFields(
+        FLAT_FIELD(OrderSwapped, quantity), FLAT_FIELD(OrderSwapped, no),
+        FLAT_FIELD(OrderSwapped, timestamp), FLAT_FIELD(OrderSwapped, price),
+        FLAT_FIELD(OrderSwapped, symbol), FLAT_FIELD(OrderSwapped, note));
+  }
+};
+
+constexpr int kMessages = 2000000;
+const char *const kSymbols[] = {"AAPL", "GOOG", "MSFT", "TSLA"};
+const char *const kNote = "limit order, good till cancelled";
+
+template <typename F>
+double Time(F &&run) {
+  auto start = std::chrono::steady_clock::now();
+  run();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kMessages;
+}
+
+// Text baseline: one line per message, fields separated by spaces.
+size_t EncodeText(char *buf, size_t n, int i) {
+  return snprintf(buf, n, "%d %d %lld %.2f %s %s\n", i, i % 100,
+                  static_cast<long long>(1000000 + i), i * 0.25,
+                  kSymbols[i % 4], kNote);
+}
+
+int64_t DecodeText(const char *buf) {
+  char *end;
+  int64_t sum = strtol(buf, &end, 10);
+  sum += strtol(end, &end, 10);
+  sum += strtoll(end, &end, 10);
+  sum += static_cast<int64_t>(strtod(end, &end));
+  const char *symbol = end + 1;
+  const char *note = strchr(symbol, ' ') + 1;
+  sum += note - symbol;
+  sum += strchr(note, '\n') - note;
+  return sum;
+}
+
+size_t EncodeFlat(char *buf, size_t n, int i) {
+  flat::Builder<Order> b;
+  b->no = i;
+  b->quantity = i % 100;
+  b->timestamp = 1000000 + i;
+  b->price = i * 0.25;
+  b.Set(&Order::symbol, kSymbols[i % 4]);
+  b.Set(&Order::note, kNote);
+  return b.CopyTo(buf, n);
+}
+
+int64_t DecodeFlat(const char *buf, size_t n) {
+  flat::View<Order> v;
+  if (v.Open(buf, n) != flat::Status::kOk) return 0;
+  return v->no + v->quantity + v->timestamp +
+         static_cast<int64_t>(v->price) + v[v->symbol].size() + 1 +
+         v[v->note].size();
+}
+
+// Sends a few messages through a pipe with writev() and reads them in place
+// from the receive buffer.
+bool PipeRoundTrip() {
+  int fds[2];
+  pipe(fds);
+
+  pid_t child_pid = fork();
+  if (child_pid == 0) {
+    close(fds[0]);
+    for (int i = 0; i < 3; i++) {
+      flat::Builder<Order> b;
+      b->no = i;
+      b->price = i * 0.25;
+      b.Set(&Order::symbol, kSymbols[i]);
+      b.Set(&Order::note, kNote);
+      b.WriteTo(fds[1]);
+    }
+    close(fds[1]);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  alignas(flat::kAlign) char buf[4096];
+  size_t filled = 0;
+  ssize_t count;
+  while ((count = read(fds[0], buf + filled, sizeof buf - filled)) > 0)
+    filled += count;
+  close(fds[0]);
+  waitpid(child_pid, nullptr, 0);
+
+  int received = 0;
+  for (size_t offset = 0; offset < filled;) {
+    flat::View<Order> v;
+    flat::Status status = v.Open(buf + offset, filled - offset);
+    if (status != flat::Status::kOk) {
+      std::cerr << "Bad message: " << flat::StatusName(status) << std::endl;
+      return false;
+    }
+    std::cout << "No." << v->no << " " << v[v->symbol] << " @ " << v->price
+              << ": " << v[v->note] << std::endl;
+    offset += v.size();
+    received++;
+  }
+  return received == 3;
+}
+
+// A view that was never opened, or whose last Open() failed, must hand
+// out empty tails rather than read through a stale size.
+bool FailedOpenIsEmpty() {
+  alignas(flat::kAlign) char buf[256];
+  flat::View<Order> v;
+  flat::Bytes ref = {sizeof(Order), 4};
+  if (!v[ref].empty()) return false;
+  size_t n = EncodeFlat(buf, sizeof buf, 2);
+  if (v.Open(buf, n) != flat::Status::kOk || v[v->symbol] != "MSFT")
+    return false;
+  if (v.Open(buf, sizeof(flat::Header) - 1) != flat::Status::kTruncated)
+    return false;
+  return v.size() == 0 && v[ref].empty();
+}
+
+// A same-size layout change is caught, and tails that would overflow the
+// 32-bit size fields are refused instead of truncated.
+bool LayoutChecked() {
+  static_assert(sizeof(OrderSwapped) == sizeof(Order), "size changed");
+  alignas(flat::kAlign) char buf[256];
+  size_t n = EncodeFlat(buf, sizeof buf, 1);
+  flat::View<OrderSwapped> swapped;
+  if (swapped.Open(buf, n) != flat::Status::kWrongLayout) return false;
+
+  static const char byte = 0;  // never read: Set() must refuse first
+  flat::Builder<Order> b;
+  if (b.Set(&Order::note, &byte, size_t(UINT32_MAX) + 1)) return false;
+  if (!b.Set(&Order::note, &byte, size_t(1) << 31)) return false;
+  if (b.Set(&Order::symbol, &byte, size_t(1) << 31)) return false;
+  return b.size() == sizeof(flat::Header) + flat::Schema<Order>::kBodySize +
+                         (size_t(1) << 31);
+}
+
+int main() {
+  if (!PipeRoundTrip()) return 1;
+  if (!FailedOpenIsEmpty()) {
+    std::cerr << "Failed Open() left a usable view" << std::endl;
+    return 1;
+  }
+  if (!LayoutChecked()) {
+    std::cerr << "Layout change or oversized tail not rejected" << std::endl;
+    return 1;
+  }
+
+  alignas(flat::kAlign) char buf[256];
+  int64_t text_sum = 0, flat_sum = 0;
+  size_t text_size = 0, flat_size = 0;
+
+  double text_encode = Time([&] {
+    for (int i = 0; i < kMessages; i++)
+      text_size += EncodeText(buf, sizeof buf, i);
+  });
+  double text_decode = Time([&] {
+    for (int i = 0; i < kMessages; i++) {
+      EncodeText(buf, sizeof buf, i);
+      text_sum += DecodeText(buf);
+    }
+  });
+  double flat_encode = Time([&] {
+    for (int i = 0; i < kMessages; i++)
+      flat_size += EncodeFlat(buf, sizeof buf, i);
+  });
+  double flat_decode = Time([&] {
+    for (int i = 0; i < kMessages; i++) {
+      size_t n = EncodeFlat(buf, sizeof buf, i);
+      flat_sum += DecodeFlat(buf, n);
+    }
+  });
+
+  // Decode timings include an encode, so report decode as the difference.
+  printf("\n%-6s %10s %10s %10s\n", "format", "encode ns", "decode ns",
+         "bytes/msg");
+  printf("%-6s %10.1f %10.1f %10.1f\n", "text", text_encode,
+         text_decode - text_encode, static_cast<double>(text_size) / kMessages);
+  printf("%-6s %10.1f %10.1f %10.1f\n", "flat", flat_encode,
+         flat_decode - flat_encode, static_cast<double>(flat_size) / kMessages);
+
+  if (text_sum != flat_sum) {
+    std::cerr << "Checksums differ: " << text_sum << " vs " << flat_sum
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "record_splitter.h"
+
+const int buf_size = getpagesize();
+constexpr size_t kDataSize = 256 << 20;
+constexpr size_t kLongRecord = 64 << 20;
+
+struct Result {
+  size_t records = 0, bytes = 0;
+};
+
+// Same loop as Read() in pipe/pipe_com.cpp.
+Result ReadWithFgets(int fd) {
+  Result r;
+  char buf[buf_size];
+  FILE *stream = fdopen(dup(fd), "r");
+  while (!feof(stream) && !ferror(stream) &&
+         fgets(buf, sizeof buf, stream) != nullptr) {
+    size_t length = strlen(buf);
+    r.bytes += length;
+    if (length > 0 && buf[length - 1] == '\n') r.records++;
+  }
+  fclose(stream);
+  return r;
+}
+
+Result ReadWithSplitter(
+    int fd, record::Framing framing,
+    size_t max_record = record::Splitter::kDefaultMaxRecord) {
+  Result r;
+  record::Splitter splitter(framing, 1 << 20, max_record);
+  std::string_view rec;
+  while (splitter.Fill(fd) > 0) {
+    while (splitter.Next(&rec)) {
+      r.records++;
+      r.bytes += rec.size() + (framing == record::Framing::kNewline ? 1 : 4);
+    }
+  }
+  return r;
+}
+
+template <typename F>
+void Report(const char *name, F &&run) {
+  auto start = std::chrono::steady_clock::now();
+  Result r = run();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("%-28s %10zu records %8.3f s %8.2f GB/s\n", name, r.records,
+         elapsed.count(), r.bytes / elapsed.count() / 1e9);
+}
+
+// Fills a temporary file with newline-terminated lines of varying length.
+int MakeLineFile() {
+  char path[] = "/tmp/record_benchXXXXXX";
+  int fd = mkstemp(path);
+  unlink(path);
+
+  std::string chunk;
+  unsigned seed = 1;
+  while (chunk.size() < (1 << 20)) {
+    size_t length = 16 + rand_r(&seed) % 240;
+    for (size_t i = 0; i < length; i++) chunk.push_back('A' + i % 26);
+    chunk.push_back('\n');
+  }
+  for (size_t done = 0; done < kDataSize; done += chunk.size())
+    write(fd, chunk.data(), chunk.size());
+  return fd;
+}
+
+// Forks a writer that sends length-prefixed records through a pipe.
+pid_t SpawnRecordWriter(int *read_fd) {
+  int fds[2];
+  pipe(fds);
+  pid_t child_pid = fork();
+  if (child_pid != 0) {
+    close(fds[1]);
+    *read_fd = fds[0];
+    return child_pid;
+  }
+
+  close(fds[0]);
+  std::string chunk;
+  unsigned seed = 1;
+  while (chunk.size() < (1 << 20)) {
+    uint32_t length = 16 + rand_r(&seed) % 240;
+    chunk.append(reinterpret_cast<char *>(&length), sizeof length);
+    for (size_t i = 0; i < length; i++) chunk.push_back('A' + i % 26);
+  }
+  for (size_t done = 0; done < kDataSize; done += chunk.size())
+    write(fds[1], chunk.data(), chunk.size());
+  close(fds[1]);
+  _exit(0);
+}
+
+// Forks a writer that sends a single kLongRecord-byte line through a pipe.
+pid_t SpawnLongLineWriter(int *read_fd) {
+  int fds[2];
+  pipe(fds);
+  pid_t child_pid = fork();
+  if (child_pid != 0) {
+    close(fds[1]);
+    *read_fd = fds[0];
+    return child_pid;
+  }
+
+  close(fds[0]);
+  std::string chunk(1 << 20, 'x');
+  for (size_t done = 0; done < kLongRecord; done += chunk.size())
+    write(fds[1], chunk.data(), chunk.size());
+  write(fds[1], "\n", 1);
+  close(fds[1]);
+  _exit(0);
+}
+
+// Records over max_record stop the splitter instead of growing its buffer.
+bool OversizedRejected() {
+  record::Splitter prefixed(record::Framing::kLengthPrefix, 4096, 1024);
+  uint32_t hostile = UINT32_MAX;
+  std::string_view rec;
+  prefixed.Feed(reinterpret_cast<const char *>(&hostile), sizeof hostile);
+  bool ok = !prefixed.Next(&rec) && prefixed.oversized() &&
+            !prefixed.Feed("x", 1) && errno == EMSGSIZE;
+
+  record::Splitter lines(record::Framing::kNewline, 4096, 1024);
+  std::string fits(1000, 'a'), endless(2000, 'b');
+  fits += '\n';
+  lines.Feed(fits.data(), fits.size());
+  ok &= lines.Next(&rec) && rec.size() == 1000;
+  lines.Feed(endless.data(), endless.size());
+  ok &= !lines.Next(&rec) && lines.oversized();
+
+  int fds[2];
+  pipe(fds);
+  write(fds[1], "y", 1);
+  ok &= lines.Fill(fds[0]) == -1 && errno == EMSGSIZE;
+  close(fds[0]);
+  close(fds[1]);
+  return ok;
+}
+
+int main() {
+  if (!OversizedRejected()) {
+    std::cerr << "Oversized record not rejected\n";
+    return 1;
+  }
+
+  int fd = MakeLineFile();
+  auto rewind = [fd] { lseek(fd, 0, SEEK_SET); };
+
+  std::cout << "Newline framing, " << (kDataSize >> 20)
+            << " MB from page cache:\n";
+  rewind();
+  ReadWithFgets(fd);  // warm the page cache
+  rewind();
+  Report("fgets", [&] { return ReadWithFgets(fd); });
+
+  rewind();
+  Report("splitter", [&] {
+    return ReadWithSplitter(fd, record::Framing::kNewline);
+  });
+  close(fd);
+
+  std::cout << "\nLength-prefixed framing, " << (kDataSize >> 20)
+            << " MB through a pipe:\n";
+  int read_fd;
+  pid_t child_pid = SpawnRecordWriter(&read_fd);
+  Report("splitter (length prefix)", [&] {
+    return ReadWithSplitter(read_fd, record::Framing::kLengthPrefix);
+  });
+  close(read_fd);
+  waitpid(child_pid, nullptr, 0);
+
+  // One record far larger than a read: each Fill() adds a pipe's worth,
+  // and Next() must not rescan what it has already searched.
+  std::cout << "\nOne " << (kLongRecord >> 20)
+            << " MB newline record through a pipe:\n";
+  child_pid = SpawnLongLineWriter(&read_fd);
+  Report("splitter (long record)", [&] {
+    return ReadWithSplitter(read_fd, record::Framing::kNewline, kLongRecord);
+  });
+  close(read_fd);
+  waitpid(child_pid, nullptr, 0);
+
+  return 0;
+}
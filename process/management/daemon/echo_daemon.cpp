@@ -0,0 +1,207 @@
+#include <arpa/inet.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "handoff.h"
+
+// Tiny TCP daemon that answers every connection with "PONG <pid>\n".
+//
+//   echo_daemon [-f] [port]    -f: stay in the foreground
+//
+// `kill -HUP <pid>` starts a new copy of the binary, which inherits the
+// listening socket through handoff::Supervisor; this copy then drains and
+// exits, closing connections still open after kDrainTimeout.  `kill -TERM
+// <pid>` stops it for good.
+
+enum Source : uint32_t { kListener, kSignal, kControl, kSuccessor, kClient };
+
+// An idle keep-alive client must not keep a retired instance alive.
+constexpr std::chrono::seconds kDrainTimeout(30);
+
+int CreateListener(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  struct sockaddr_in name;
+  memset(&name, 0, sizeof name);
+  name.sin_family = AF_INET;
+  name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  name.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&name), sizeof name) == -1 ||
+      listen(fd, 1024) == -1) {
+    perror("listen");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+// Starts the replacement with the same arguments.  /proc/self/exe gives
+// the path this binary was started from; exec'ing that path, rather than
+// /proc/self/exe itself (which stays the old, possibly deleted, file),
+// picks up a new version installed over it.
+void Respawn(char *argv[], const sigset_t &blocked) {
+  char path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof path - 1);
+  if (length == -1) return;
+  path[length] = '\0';
+  const char *deleted = strstr(path, " (deleted)");
+  if (deleted != nullptr) path[deleted - path] = '\0';
+
+  pid_t child_pid = fork();
+  if (child_pid != 0) return;
+  sigprocmask(SIG_UNBLOCK, &blocked, nullptr);
+  execv(path, argv);
+  _exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool foreground = false;
+  int port = 18080;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0)
+      foreground = true;
+    else
+      port = atoi(argv[i]);
+  }
+
+  handoff::Supervisor supervisor("/tmp/echo_daemon." + std::to_string(port) +
+                                 ".ctl");
+  std::vector<handoff::NamedFd> fds;
+  int inherited = supervisor.Inherit(&fds);
+  if (inherited == -1) {
+    perror("inherit");
+    return EXIT_FAILURE;
+  }
+  int listen_fd = handoff::FindFd(fds, "http");
+  if (listen_fd == -1) {
+    listen_fd = CreateListener(port);
+    fds = {{"http", listen_fd}};
+    if (!foreground && handoff::Daemonize() == -1) return EXIT_FAILURE;
+  }
+
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGHUP);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &blocked, nullptr);
+  int signal_fd = signalfd(-1, &blocked, SFD_CLOEXEC | SFD_NONBLOCK);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  // Events carry their source as well as the descriptor, so a stale event
+  // for a descriptor closed earlier in the same batch is recognised.
+  auto watch = [epoll_fd](int fd, Source source) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = static_cast<uint64_t>(source) << 32 | fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  };
+  watch(listen_fd, kListener);
+  watch(signal_fd, kSignal);
+
+  // Accepting on the inherited socket already; now retire the predecessor.
+  if (supervisor.Ready() == -1) {
+    perror("ready");
+    return EXIT_FAILURE;
+  }
+  watch(supervisor.fd(), kControl);
+  // The control socket stays readable until HandOff() accepts, and epoll
+  // is level-triggered: mute it while a successor is pending.
+  auto listen_control = [&](bool on) {
+    struct epoll_event ev = {};
+    ev.events = on ? EPOLLIN : 0;
+    ev.data.u64 = static_cast<uint64_t>(kControl) << 32 | supervisor.fd();
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, supervisor.fd(), &ev);
+  };
+
+  int successor_fd = -1;
+  std::unordered_set<int> clients;
+  bool draining = false;
+  std::chrono::steady_clock::time_point drain_deadline;
+  char reply[64];
+  int reply_size = snprintf(reply, sizeof reply, "PONG %d\n", getpid());
+
+  auto stop_accepting = [&] {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+    for (auto &f : fds) close(f.fd);
+    fds.clear();
+    draining = true;
+    drain_deadline = std::chrono::steady_clock::now() + kDrainTimeout;
+  };
+
+  while (!draining ||
+         (!clients.empty() &&
+          std::chrono::steady_clock::now() < drain_deadline)) {
+    struct epoll_event events[64];
+    int count = epoll_wait(epoll_fd, events, 64, draining ? 100 : -1);
+    for (int i = 0; i < count; i++) {
+      Source source = static_cast<Source>(events[i].data.u64 >> 32);
+      int fd = static_cast<int>(events[i].data.u64);
+
+      if (source == kListener) {
+        if (draining) continue;
+        int conn;
+        while ((conn = accept4(listen_fd, nullptr, nullptr,
+                               SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+          watch(conn, kClient);
+          clients.insert(conn);
+        }
+      } else if (source == kSignal) {
+        struct signalfd_siginfo info;
+        while (read(signal_fd, &info, sizeof info) == sizeof info) {
+          if (info.ssi_signo == SIGHUP && !draining && successor_fd == -1)
+            Respawn(argv, blocked);
+          if (info.ssi_signo == SIGTERM && !draining) {
+            stop_accepting();
+            supervisor.Shutdown();
+          }
+          if (info.ssi_signo == SIGCHLD) {
+            while (waitpid(-1, nullptr, WNOHANG) > 0) {
+            }
+          }
+        }
+      } else if (source == kControl) {
+        if (draining || fd != supervisor.fd() || successor_fd != -1) continue;
+        successor_fd = supervisor.HandOff(fds);
+        if (successor_fd == -1) continue;
+        watch(successor_fd, kSuccessor);
+        listen_control(false);
+      } else if (source == kSuccessor) {
+        if (fd != successor_fd) continue;
+        int finished = supervisor.Finish();  // closes successor_fd when done
+        if (finished == -1) continue;
+        successor_fd = -1;
+        if (finished == 1)
+          stop_accepting();  // Finish() closed the control socket
+        else if (!draining)
+          listen_control(true);
+      } else {
+        char request[256];
+        ssize_t n = read(fd, request, sizeof request);
+        if (n > 0) write(fd, reply, reply_size);
+        if (n == -1 && errno == EAGAIN) continue;
+        close(fd);
+        clients.erase(fd);
+      }
+    }
+  }
+
+  for (int fd : clients) close(fd);  // still open at the drain deadline
+  return 0;
+}
@@ -0,0 +1,300 @@
+#ifndef PROCESS_MANAGEMENT_DAEMON_HANDOFF_H_
+#define PROCESS_MANAGEMENT_DAEMON_HANDOFF_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+// Zero-downtime restart for daemons.
+//
+// The running instance listens on a control socket.  Its replacement
+// connects there on startup and receives the listening sockets (and any
+// shared-memory state fds) over SCM_RIGHTS, so the kernel's accept queue is
+// never closed.  Once the replacement accepts on them it calls Ready(); the
+// old instance confirms, stops accepting, drains its in-flight connections
+// and exits.  Functions return -1 and set errno on failure.
+namespace handoff {
+
+constexpr int kMaxFds = 64;
+constexpr char kReady = 'R';
+
+struct NamedFd {
+  std::string name;
+  int fd;
+};
+
+// Sends the descriptors and their names ("name\0name\0...") in one message.
+inline int SendFds(int sock, const std::vector<NamedFd> &fds) {
+  if (fds.size() > kMaxFds) {
+    errno = E2BIG;
+    return -1;
+  }
+  std::string names;
+  for (const auto &f : fds) names.append(f.name).push_back('\0');
+  if (names.empty()) names.push_back('\0');
+
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * kMaxFds)];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {&names[0], names.size()};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (!fds.empty()) {
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    int *out = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+    for (size_t i = 0; i < fds.size(); i++) out[i] = fds[i].fd;
+  }
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == -1 ? -1 : 0;
+}
+
+inline int RecvFds(int sock, std::vector<NamedFd> *fds) {
+  char names[4096];
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * kMaxFds)];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {names, sizeof names};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+
+  ssize_t count = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (count <= 0) {
+    if (count == 0) errno = ECONNRESET;
+    return -1;
+  }
+
+  std::vector<int> received;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int *in = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+    received.insert(received.end(), in, in + n);
+  }
+
+  fds->clear();
+  const char *name = names;
+  for (int fd : received) {
+    if (name >= names + count) name = "";
+    fds->push_back({name, fd});
+    name += strlen(name) + 1;
+  }
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+    for (auto &f : *fds) close(f.fd);
+    fds->clear();
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return fds->size();
+}
+
+// Returns the descriptor called `name`, or -1.
+inline int FindFd(const std::vector<NamedFd> &fds, const char *name) {
+  for (const auto &f : fds)
+    if (f.name == name) return f.fd;
+  return -1;
+}
+
+// The daemon recipe from Readme 2.3.7, except that descriptors other than
+// the standard streams are kept: they may be sockets to hand off later.
+inline int Daemonize() {
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+  if (pid != 0) exit(EXIT_SUCCESS);
+
+  if (setsid() == -1) return -1;
+  if (chdir("/") == -1) return -1;
+  umask(0);
+  int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd == -1) return -1;
+  for (int i = 0; i < 3; i++) dup2(null_fd, i);
+  if (null_fd > 2) close(null_fd);
+  return 0;
+}
+
+class Supervisor {
+ public:
+  explicit Supervisor(const std::string &control_path)
+      : path_(control_path) {}
+  Supervisor(const Supervisor &) = delete;
+  Supervisor &operator=(const Supervisor &) = delete;
+  ~Supervisor() {
+    if (peer_fd_ != -1) close(peer_fd_);
+    if (successor_fd_ != -1) close(successor_fd_);
+    if (listen_fd_ != -1) close(listen_fd_);
+  }
+
+  // Asks a running predecessor for its descriptors.  Returns 1 when they
+  // were handed over (call Ready() once accepting on them), 0 when there is
+  // no predecessor and the caller should create its own sockets.
+  int Inherit(std::vector<NamedFd> *fds) {
+    fds->clear();
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) return -1;
+    struct sockaddr_un name = Address(path_);
+    if (connect(sock, reinterpret_cast<struct sockaddr *>(&name),
+                SUN_LEN(&name)) == -1) {
+      int saved = errno;
+      close(sock);
+      if (saved == ENOENT || saved == ECONNREFUSED) return 0;
+      errno = saved;
+      return -1;
+    }
+    if (RecvFds(sock, fds) == -1) {
+      int saved = errno;
+      close(sock);
+      errno = saved;
+      return -1;
+    }
+    peer_fd_ = sock;
+    return 1;
+  }
+
+  // Tells the predecessor (if any) to stop accepting, waits for it to
+  // confirm, then takes over the control path so the next replacement
+  // finds this instance.  The socket is bound under a temporary name and
+  // renamed into place only after the confirmation: if this instance dies
+  // before then, the predecessor never saw kReady and keeps both serving
+  // and the path.  Without a confirmation Ready() fails and the caller
+  // should exit, leaving the predecessor in charge.
+  int Ready() {
+    std::string tmp = path_ + "." + std::to_string(getpid());
+    unlink(tmp.c_str());
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) return -1;
+    struct sockaddr_un name = Address(tmp);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&name), SUN_LEN(&name)) ==
+            -1 ||
+        listen(fd, 1) == -1 || Retire() == -1 ||
+        rename(tmp.c_str(), path_.c_str()) == -1) {
+      int saved = errno;
+      close(fd);
+      unlink(tmp.c_str());
+      errno = saved;
+      return -1;
+    }
+    listen_fd_ = fd;
+    return 0;
+  }
+
+  // Control socket to watch for a replacement, -1 before Ready().
+  int fd() const { return listen_fd_; }
+
+  // Call when fd() is readable.  Sends `fds` to the replacement and returns
+  // a descriptor to watch for its answer; keep serving meanwhile and call
+  // Finish() once it is readable.
+  int HandOff(const std::vector<NamedFd> &fds) {
+    int conn = accept4(listen_fd_, nullptr, nullptr,
+                       SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn == -1) return -1;
+    if (SendFds(conn, fds) == -1) {
+      int saved = errno;
+      close(conn);
+      errno = saved;
+      return -1;
+    }
+    if (successor_fd_ != -1) close(successor_fd_);
+    successor_fd_ = conn;
+    return conn;
+  }
+
+  // Returns 1 when the replacement has taken over and this instance should
+  // stop accepting and drain, 0 if it went away first (keep serving), -1
+  // with EAGAIN if it has not answered yet.
+  int Finish() {
+    char ready = 0;
+    ssize_t count = read(successor_fd_, &ready, 1);
+    if (count == -1 && errno == EAGAIN) return -1;
+    if (count != 1 || ready != kReady) {
+      close(successor_fd_);
+      successor_fd_ = -1;
+      return 0;
+    }
+
+    // Confirm, so the replacement takes over the control path.  If it
+    // died after asking, the path is still ours: keep serving.
+    count = send(successor_fd_, &ready, 1, MSG_NOSIGNAL);
+    close(successor_fd_);
+    successor_fd_ = -1;
+    if (count != 1) return 0;
+
+    // The replacement owns the control path now; only drop our socket.
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return 1;
+  }
+
+  // Removes the control path on a final shutdown.  After a successful
+  // HandOff() the path belongs to the replacement and is left alone.
+  void Shutdown() {
+    if (listen_fd_ == -1) return;
+    unlink(path_.c_str());
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+
+ private:
+  static constexpr int kConfirmSeconds = 5;
+
+  // Sends kReady to the predecessor and waits for it to echo it back.
+  int Retire() {
+    if (peer_fd_ == -1) return 0;
+    char ready = kReady;
+    struct timeval timeout = {kConfirmSeconds, 0};
+    setsockopt(peer_fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    ssize_t count = send(peer_fd_, &ready, 1, MSG_NOSIGNAL);
+    if (count == 1) {
+      ready = 0;
+      do {
+        count = recv(peer_fd_, &ready, 1, 0);
+      } while (count == -1 && errno == EINTR);
+    }
+    int saved = errno;
+    close(peer_fd_);
+    peer_fd_ = -1;
+    if (count == 1 && ready == kReady) return 0;
+    errno = count == -1 ? saved : ECONNRESET;
+    return -1;
+  }
+
+  static struct sockaddr_un Address(const std::string &path) {
+    struct sockaddr_un name;
+    memset(&name, 0, sizeof name);
+    name.sun_family = AF_UNIX;
+    strncpy(name.sun_path, path.c_str(), sizeof name.sun_path - 1);
+    return name;
+  }
+
+  std::string path_;
+  int peer_fd_ = -1;       // predecessor, until Ready()
+  int successor_fd_ = -1;  // replacement, between HandOff() and Finish()
+  int listen_fd_ = -1;     // control socket
+};
+
+}  // namespace handoff
+
+#endif  // PROCESS_MANAGEMENT_DAEMON_HANDOFF_H_
@@ -0,0 +1,177 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hammers echo_daemon with one-request connections while restarting it, and
+// reports requests dropped and the longest gap between answered requests.
+//
+//   load_generator [--cold] [restarts]
+//
+// By default restarts go through SIGHUP and the socket handoff; --cold stops
+// the daemon and starts a fresh one instead, for comparison.
+
+constexpr int kPort = 18080;
+constexpr int kClients = 4;
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<bool> stop{false};
+std::atomic<int> latest_pid{0};
+std::atomic<long> dropped{0};
+
+struct ClientLog {
+  std::vector<Clock::time_point> answered;
+};
+
+// Returns the pid in the daemon's answer, or -1 if the request failed.
+int Request() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct timeval timeout = {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  struct sockaddr_in name;
+  memset(&name, 0, sizeof name);
+  name.sin_family = AF_INET;
+  name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  name.sin_port = htons(kPort);
+
+  int pid = -1;
+  char reply[64] = {0};
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&name), sizeof name) == 0 &&
+      write(fd, "PING\n", 5) == 5) {
+    size_t filled = 0;
+    ssize_t count;
+    while (filled < sizeof reply - 1 &&
+           (count = read(fd, reply + filled, sizeof reply - 1 - filled)) > 0)
+      filled += count;
+    if (sscanf(reply, "PONG %d", &pid) != 1) pid = -1;
+  }
+  close(fd);
+  return pid;
+}
+
+void Client(ClientLog *log) {
+  while (!stop) {
+    int pid = Request();
+    if (pid == -1) {
+      dropped++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    log->answered.push_back(Clock::now());
+    latest_pid = pid;
+  }
+}
+
+pid_t Launch(const std::string &daemon_path) {
+  pid_t child_pid = fork();
+  if (child_pid == 0) {
+    std::string port = std::to_string(kPort);
+    execl(daemon_path.c_str(), daemon_path.c_str(), "-f", port.c_str(),
+          static_cast<char *>(nullptr));
+    _exit(EXIT_FAILURE);
+  }
+  return child_pid;
+}
+
+// Waits for an answer from some process other than `old_pid`.
+int WaitForNewPid(int old_pid) {
+  while (true) {
+    int pid = latest_pid;
+    if (pid != 0 && pid != old_pid) return pid;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool cold = false;
+  int restarts = 10;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cold") == 0)
+      cold = true;
+    else
+      restarts = atoi(argv[i]);
+  }
+  std::string self = argv[0];
+  std::string daemon_path =
+      self.substr(0, self.find_last_of('/') + 1) + "echo_daemon";
+
+  // Replacements are forked by the old daemon; adopt them when it exits so
+  // they can be reaped here.
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+  Launch(daemon_path);
+
+  std::vector<ClientLog> logs(kClients);
+  std::vector<std::thread> clients;
+  for (auto &log : logs) clients.emplace_back(&Client, &log);
+  int pid = WaitForNewPid(0);
+
+  std::vector<double> switch_ms;
+  auto start = Clock::now();
+  long dropped_before = dropped;
+  for (int i = 0; i < restarts; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto restart = Clock::now();
+    if (cold) {
+      kill(pid, SIGTERM);
+      waitpid(pid, nullptr, 0);
+      Launch(daemon_path);
+    } else {
+      kill(pid, SIGHUP);
+    }
+    pid = WaitForNewPid(pid);
+    switch_ms.push_back(
+        std::chrono::duration<double, std::milli>(Clock::now() - restart)
+            .count());
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto end = Clock::now();
+
+  stop = true;
+  for (auto &t : clients) t.join();
+  kill(latest_pid, SIGTERM);
+  while (wait(nullptr) > 0) {
+  }
+
+  // Merge every client's answers and find the longest silence.
+  std::vector<Clock::time_point> answered;
+  for (auto &log : logs)
+    for (auto t : log.answered)
+      if (t >= start && t <= end) answered.push_back(t);
+  std::sort(answered.begin(), answered.end());
+  double max_gap_ms = 0;
+  for (size_t i = 1; i < answered.size(); i++)
+    max_gap_ms = std::max(
+        max_gap_ms, std::chrono::duration<double, std::milli>(answered[i] -
+                                                              answered[i - 1])
+                        .count());
+
+  double total_switch = 0, max_switch = 0;
+  for (double ms : switch_ms) {
+    total_switch += ms;
+    max_switch = std::max(max_switch, ms);
+  }
+
+  std::cout << (cold ? "Cold restarts: " : "Handoff restarts: ") << restarts
+            << "\n  requests answered: " << answered.size()
+            << "\n  requests dropped:  " << dropped - dropped_before
+            << "\n  longest gap:       " << max_gap_ms << " ms"
+            << "\n  new pid serving:   " << total_switch / restarts
+            << " ms mean, " << max_switch << " ms max" << std::endl;
+  return 0;
+}
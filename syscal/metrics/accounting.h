@@ -0,0 +1,318 @@
+#ifndef SYSCAL_METRICS_ACCOUNTING_H_
+#define SYSCAL_METRICS_ACCOUNTING_H_
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+// Per-thread and per-child resource accounting (Readme 1.1.5, 2.3.4).
+//
+//   metrics::RegisterThread("worker-3");    // first thing in the thread
+//   ...
+//   pid_t pid = metrics::Wait4(-1, &status, WNOHANG);  // instead of wait()
+//   ...
+//   for (const metrics::ThreadUsage &t : metrics::Threads().Collect()) ...
+//   metrics::ChildTotals all = metrics::Children().totals();
+//
+// A registered thread is read from outside through its CPU-time clock
+// (pthread_getcpuclockid, the CLOCK_THREAD_CPUTIME_ID of another thread)
+// and /proc/self/task/<tid>/{status,schedstat} for context switches and
+// run-queue wait, so the hot path pays nothing.  When it exits, the thread
+// takes its own final reading and folds it into a per-name total, so
+// short-lived workers are not lost and the live list stays short.
+//
+// Wait4() is wait4(2) that keeps the rusage instead of throwing it away:
+// running totals, a histogram of CPU time per child, and the last
+// kRecentChildren children.  It takes no locks and does not allocate, so
+// it can be called from a SIGCHLD handler.
+namespace metrics {
+
+struct ThreadUsage {
+  pid_t tid;             // 0 for threads that have exited
+  std::string name;
+  uint64_t threads;      // threads folded into this entry
+  uint64_t cpu_ns;
+  uint64_t wait_ns;      // runnable but not running; 0 without schedstats
+  uint64_t voluntary;    // blocked, gave up the CPU
+  uint64_t involuntary;  // preempted
+};
+
+namespace detail {
+
+// Reads a small /proc file into `buf`, NUL-terminated.
+inline bool ReadSmallFile(const char *path, char *buf, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  ssize_t n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0) return false;
+  buf[n] = '\0';
+  return true;
+}
+
+// The number after `key` in `text`, or 0.
+inline uint64_t Field(const char *text, const char *key) {
+  const char *p = strstr(text, key);
+  return p ? strtoull(p + strlen(key), nullptr, 10) : 0;
+}
+
+// Run-queue wait and context switches of `task`, a /proc task directory.
+inline void ReadTask(const char *task, ThreadUsage *usage) {
+  char path[64], buf[2048];
+  snprintf(path, sizeof path, "%s/schedstat", task);
+  if (ReadSmallFile(path, buf, sizeof buf)) {
+    char *p = buf;
+    strtoull(p, &p, 10);  // run time; the CPU clock is more precise
+    usage->wait_ns = strtoull(p, nullptr, 10);
+  }
+  snprintf(path, sizeof path, "%s/status", task);
+  if (ReadSmallFile(path, buf, sizeof buf)) {
+    usage->voluntary = Field(buf, "\nvoluntary_ctxt_switches:");
+    usage->involuntary = Field(buf, "\nnonvoluntary_ctxt_switches:");
+  }
+}
+
+inline uint64_t ClockNs(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0) return 0;
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}  // namespace detail
+
+class ThreadRegistry {
+ public:
+  // Tracks the calling thread under `name` until it exits.  Registering
+  // again only renames it.
+  void Register(std::string name) {
+    static thread_local Guard guard;
+    std::lock_guard<std::mutex> lock(mutex_);
+    pid_t tid = syscall(SYS_gettid);
+    Live &live = live_[tid];
+    live.name = std::move(name);
+    pthread_getcpuclockid(pthread_self(), &live.clock);
+    guard.registry = this;
+  }
+
+  // Live threads in tid order, then one entry per name for exited ones.
+  std::vector<ThreadUsage> Collect() const {
+    std::vector<ThreadUsage> out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &entry : live_) {
+      ThreadUsage usage = {entry.first, entry.second.name, 1, 0, 0, 0, 0};
+      usage.cpu_ns = detail::ClockNs(entry.second.clock);
+      char task[40];
+      snprintf(task, sizeof task, "/proc/self/task/%d", entry.first);
+      detail::ReadTask(task, &usage);
+      out.push_back(usage);
+    }
+    for (const auto &entry : exited_) out.push_back(entry.second);
+    return out;
+  }
+
+ private:
+  struct Live {
+    std::string name;
+    clockid_t clock;
+  };
+
+  // Unregisters its thread as the thread exits.
+  struct Guard {
+    ThreadRegistry *registry = nullptr;
+    ~Guard() {
+      if (registry != nullptr) registry->Exit();
+    }
+  };
+
+  void Exit() {
+    ThreadUsage usage = {0, "", 1, 0, 0, 0, 0};
+    usage.cpu_ns = detail::ClockNs(CLOCK_THREAD_CPUTIME_ID);
+    detail::ReadTask("/proc/thread-self", &usage);
+    rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+      usage.voluntary = ru.ru_nvcsw;
+      usage.involuntary = ru.ru_nivcsw;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = live_.find(syscall(SYS_gettid));
+    if (it == live_.end()) return;
+    ThreadUsage &total = exited_[it->second.name];
+    if (total.threads == 0) total.name = it->second.name;
+    total.threads++;
+    total.cpu_ns += usage.cpu_ns;
+    total.wait_ns += usage.wait_ns;
+    total.voluntary += usage.voluntary;
+    total.involuntary += usage.involuntary;
+    live_.erase(it);
+  }
+
+  mutable std::mutex mutex_;
+  std::map<pid_t, Live> live_;
+  std::map<std::string, ThreadUsage> exited_;
+};
+
+inline ThreadRegistry &Threads() {
+  static ThreadRegistry *registry = new ThreadRegistry;  // outlives Guards
+  return *registry;
+}
+
+inline void RegisterThread(std::string name) {
+  Threads().Register(std::move(name));
+}
+
+struct ChildUsage {
+  pid_t pid;
+  int status;  // as from wait()
+  uint64_t user_ns;
+  uint64_t system_ns;
+  uint64_t max_rss_kb;
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  uint64_t voluntary;
+  uint64_t involuntary;
+};
+
+struct ChildTotals {
+  uint64_t children;
+  uint64_t user_ns;
+  uint64_t system_ns;
+  uint64_t max_rss_kb;  // largest single child
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  uint64_t voluntary;
+  uint64_t involuntary;
+};
+
+constexpr int kRecentChildren = 64;
+
+class ChildLog {
+ public:
+  // Async-signal-safe.
+  void Record(pid_t pid, int status, const rusage &ru) {
+    ChildUsage u = {pid,
+                    status,
+                    TimevalNs(ru.ru_utime),
+                    TimevalNs(ru.ru_stime),
+                    static_cast<uint64_t>(ru.ru_maxrss),
+                    static_cast<uint64_t>(ru.ru_minflt),
+                    static_cast<uint64_t>(ru.ru_majflt),
+                    static_cast<uint64_t>(ru.ru_nvcsw),
+                    static_cast<uint64_t>(ru.ru_nivcsw)};
+
+    // Seqlock per slot: odd while being written.
+    uint64_t n = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots_[n % kRecentChildren];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.usage = u;
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+
+    Add(&user_ns_, u.user_ns);
+    Add(&system_ns_, u.system_ns);
+    Add(&minor_faults_, u.minor_faults);
+    Add(&major_faults_, u.major_faults);
+    Add(&voluntary_, u.voluntary);
+    Add(&involuntary_, u.involuntary);
+    uint64_t rss = max_rss_kb_.load(std::memory_order_relaxed);
+    while (u.max_rss_kb > rss &&
+           !max_rss_kb_.compare_exchange_weak(rss, u.max_rss_kb))
+      continue;
+    cpu_.Record(u.user_ns + u.system_ns);
+  }
+
+  // Newest first.  A slot being overwritten during the copy is skipped.
+  std::vector<ChildUsage> Recent() const {
+    std::vector<ChildUsage> out;
+    uint64_t next = next_.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < kRecentChildren && i < next; i++) {
+      uint64_t n = next - 1 - i;
+      const Slot &slot = slots_[n % kRecentChildren];
+      if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2) continue;
+      ChildUsage u = slot.usage;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != 2 * n + 2) continue;
+      out.push_back(u);
+    }
+    return out;
+  }
+
+  ChildTotals totals() const {
+    return {next_.load(std::memory_order_relaxed),
+            user_ns_.load(std::memory_order_relaxed),
+            system_ns_.load(std::memory_order_relaxed),
+            max_rss_kb_.load(std::memory_order_relaxed),
+            minor_faults_.load(std::memory_order_relaxed),
+            major_faults_.load(std::memory_order_relaxed),
+            voluntary_.load(std::memory_order_relaxed),
+            involuntary_.load(std::memory_order_relaxed)};
+  }
+
+  // User plus system CPU time of each child, in nanoseconds.
+  const Histogram &cpu() const { return cpu_; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    ChildUsage usage{};
+  };
+
+  static uint64_t TimevalNs(const timeval &tv) {
+    return tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+  }
+
+  static void Add(std::atomic<uint64_t> *counter, uint64_t value) {
+    counter->fetch_add(value, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> next_{0};
+  Slot slots_[kRecentChildren];
+  std::atomic<uint64_t> user_ns_{0};
+  std::atomic<uint64_t> system_ns_{0};
+  std::atomic<uint64_t> max_rss_kb_{0};
+  std::atomic<uint64_t> minor_faults_{0};
+  std::atomic<uint64_t> major_faults_{0};
+  std::atomic<uint64_t> voluntary_{0};
+  std::atomic<uint64_t> involuntary_{0};
+  Histogram cpu_;
+};
+
+// Constant-initialised and never destroyed, so first use from a signal
+// handler is safe.
+inline ChildLog &Children() {
+  static ChildLog log;
+  return log;
+}
+
+// wait4(2) that records the reaped child's usage.  Async-signal-safe.
+inline pid_t Wait4(pid_t pid, int *status, int options,
+                   ChildLog *log = &Children()) {
+  int st;
+  rusage ru;
+  pid_t reaped = wait4(pid, &st, options, &ru);
+  if (reaped > 0) {
+    if (status != nullptr) *status = st;
+    if (WIFEXITED(st) || WIFSIGNALED(st)) log->Record(reaped, st, ru);
+  }
+  return reaped;
+}
+
+}  // namespace metrics
+
+#endif  // SYSCAL_METRICS_ACCOUNTING_H_
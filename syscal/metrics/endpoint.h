@@ -0,0 +1,282 @@
+#ifndef SYSCAL_METRICS_ENDPOINT_H_
+#define SYSCAL_METRICS_ENDPOINT_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "accounting.h"
+#include "histogram.h"
+
+// Local metrics endpoint on a Unix stream socket.
+//
+//   metrics::Endpoint endpoint("/tmp/server.metrics");
+//   endpoint.AddHistogram("request_latency_ns", &latency);
+//   if (!endpoint.Start()) perror("metrics");
+//   ...
+//   $ socat - UNIX-CONNECT:/tmp/server.metrics   # or metrics::Scrape(path)
+//
+// Every connection gets one plain-text report in the Prometheus exposition
+// format and is closed: the registered threads' CPU time, run-queue wait
+// and context switches, the children reaped through Wait4(), and each
+// added histogram as quantiles, count, sum and max.  One thread serves
+// the socket; reports are built on that thread, away from the workers.
+namespace metrics {
+
+class Endpoint {
+ public:
+  explicit Endpoint(std::string path) : path_(std::move(path)) {}
+  Endpoint(const Endpoint &) = delete;
+  Endpoint &operator=(const Endpoint &) = delete;
+  ~Endpoint() { Stop(); }
+
+  // `read` is called on the endpoint thread at every scrape, so it can
+  // merge per-thread histograms on the spot.
+  void AddHistogram(std::string name, std::function<Snapshot()> read) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    histograms_.emplace_back(std::move(name), std::move(read));
+  }
+
+  void AddHistogram(std::string name, const Histogram *histogram) {
+    AddHistogram(std::move(name),
+                 [histogram] { return histogram->snapshot(); });
+  }
+
+  // Binds the socket, replacing a stale one, and starts serving.  Returns
+  // false with errno set if the socket cannot be set up: EADDRINUSE if
+  // the path is anything but a socket nobody is listening on.
+  bool Start() {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof addr.sun_path) {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+    memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ == -1 || pipe2(stop_fds_, O_CLOEXEC) == -1) {
+      Stop();
+      return false;
+    }
+    if (!RemoveStale(addr) ||
+        bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof addr) ==
+            -1 ||
+        listen(listen_fd_, 16) == -1) {
+      Stop();
+      return false;
+    }
+    server_ = std::thread(&Endpoint::Serve, this);
+    return true;
+  }
+
+  void Stop() {
+    if (server_.joinable()) {
+      write(stop_fds_[1], "", 1);
+      server_.join();
+      unlink(path_.c_str());
+    }
+    for (int *fd : {&listen_fd_, &stop_fds_[0], &stop_fds_[1]}) {
+      if (*fd != -1) close(*fd);
+      *fd = -1;
+    }
+  }
+
+  // The report a scrape returns.
+  std::string Render() const {
+    std::string out;
+    RenderThreads(&out);
+    RenderChildren(&out);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &h : histograms_)
+      RenderHistogram(&out, h.first, h.second());
+    return out;
+  }
+
+ private:
+  // Unlinks whatever is at `addr` only if it is a socket that refuses
+  // connections, i.e. left behind by an instance that is gone.
+  static bool RemoveStale(const sockaddr_un &addr) {
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == -1) return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode)) {
+      errno = EADDRINUSE;
+      return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) return false;
+    int rc = connect(probe, reinterpret_cast<const sockaddr *>(&addr),
+                     sizeof addr);
+    int error = rc == -1 ? errno : 0;
+    close(probe);
+    if (error != ECONNREFUSED) {
+      errno = EADDRINUSE;  // live, or not ours to judge
+      return false;
+    }
+    return unlink(addr.sun_path) == 0 || errno == ENOENT;
+  }
+
+  static void Appendf(std::string *out, const char *format, ...)
+      __attribute__((format(printf, 2, 3))) {
+    char buf[512];
+    va_list args, again;
+    va_start(args, format);
+    va_copy(again, args);
+    int n = vsnprintf(buf, sizeof buf, format, args);
+    if (n >= int(sizeof buf)) {  // a long label value: format in place
+      size_t at = out->size();
+      out->resize(at + n + 1);
+      vsnprintf(&(*out)[at], n + 1, format, again);
+      out->resize(at + n);
+    } else if (n > 0) {
+      out->append(buf, n);
+    }
+    va_end(again);
+    va_end(args);
+  }
+
+  // A label value as the exposition format quotes it: backslash, double
+  // quote and newline escaped.
+  static std::string Escape(const std::string &value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+      if (c == '\\' || c == '"') {
+        out += '\\';
+        out += c;
+      } else if (c == '\n') {
+        out += "\\n";
+      } else {
+        out += c;
+      }
+    }
+    return out;
+  }
+
+  static void RenderThreads(std::string *out) {
+    std::vector<ThreadUsage> threads = Threads().Collect();
+    struct Column {
+      const char *name;
+      uint64_t ThreadUsage::*field;
+      double scale;
+    };
+    const Column columns[] = {
+        {"thread_cpu_seconds", &ThreadUsage::cpu_ns, 1e-9},
+        {"thread_wait_seconds", &ThreadUsage::wait_ns, 1e-9},
+        {"thread_voluntary_switches", &ThreadUsage::voluntary, 1},
+        {"thread_involuntary_switches", &ThreadUsage::involuntary, 1},
+        {"thread_count", &ThreadUsage::threads, 1}};
+    for (const Column &c : columns) {
+      Appendf(out, "# TYPE %s counter\n", c.name);
+      for (const ThreadUsage &t : threads) {
+        std::string name = Escape(t.name);
+        if (t.tid != 0) {
+          Appendf(out, "%s{tid=\"%d\",name=\"%s\"} %.9g\n", c.name, t.tid,
+                  name.c_str(), t.*c.field * c.scale);
+        } else {
+          Appendf(out, "%s{tid=\"exited\",name=\"%s\"} %.9g\n", c.name,
+                  name.c_str(), t.*c.field * c.scale);
+        }
+      }
+    }
+  }
+
+  static void RenderChildren(std::string *out) {
+    ChildTotals t = Children().totals();
+    Appendf(out,
+            "# TYPE child_count counter\nchild_count %lu\n"
+            "# TYPE child_user_seconds counter\nchild_user_seconds %.9g\n"
+            "# TYPE child_system_seconds counter\n"
+            "child_system_seconds %.9g\n"
+            "# TYPE child_max_rss_kb gauge\nchild_max_rss_kb %lu\n"
+            "# TYPE child_faults counter\n"
+            "child_faults{kind=\"minor\"} %lu\n"
+            "child_faults{kind=\"major\"} %lu\n"
+            "# TYPE child_switches counter\n"
+            "child_switches{kind=\"voluntary\"} %lu\n"
+            "child_switches{kind=\"involuntary\"} %lu\n",
+            t.children, t.user_ns * 1e-9, t.system_ns * 1e-9, t.max_rss_kb,
+            t.minor_faults, t.major_faults, t.voluntary, t.involuntary);
+    Appendf(out, "# TYPE child_recent_cpu_seconds gauge\n");
+    for (const ChildUsage &c : Children().Recent())
+      Appendf(out, "child_recent_cpu_seconds{pid=\"%d\",status=\"%d\"} %.9g\n",
+              c.pid, c.status, (c.user_ns + c.system_ns) * 1e-9);
+    RenderHistogram(out, "child_cpu_ns", Children().cpu().snapshot());
+  }
+
+  static void RenderHistogram(std::string *out, const std::string &name,
+                              const Snapshot &s) {
+    Appendf(out, "# TYPE %s summary\n", name.c_str());
+    for (double q : {0.5, 0.9, 0.99, 0.999})
+      Appendf(out, "%s{quantile=\"%g\"} %lu\n", name.c_str(), q,
+              s.Percentile(q));
+    Appendf(out, "%s_count %lu\n%s_sum %lu\n%s_max %lu\n", name.c_str(),
+            s.count, name.c_str(), s.sum, name.c_str(), s.max);
+  }
+
+  void Serve() {
+    pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {stop_fds_[0], POLLIN, 0}};
+    while (true) {
+      if (poll(fds, 2, -1) == -1) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      if (fds[1].revents) return;
+      int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client == -1) continue;
+      // A reader that stops reading must not wedge the endpoint.
+      timeval timeout = {1, 0};
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+      std::string report = Render();
+      for (size_t done = 0; done < report.size();) {
+        ssize_t n = send(client, report.data() + done, report.size() - done,
+                         MSG_NOSIGNAL);
+        if (n <= 0) break;
+        done += n;
+      }
+      close(client);
+    }
+  }
+
+  std::string path_;
+  int listen_fd_ = -1;
+  int stop_fds_[2] = {-1, -1};
+  std::thread server_;
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, std::function<Snapshot()>>> histograms_;
+};
+
+// Client side: the report served at `path`, or "" if nothing answers.
+inline std::string Scrape(const std::string &path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path) return "";
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) return "";
+  std::string out;
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == 0) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0) out.append(buf, n);
+  }
+  close(fd);
+  return out;
+}
+
+}  // namespace metrics
+
+#endif  // SYSCAL_METRICS_ENDPOINT_H_
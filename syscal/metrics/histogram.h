@@ -0,0 +1,151 @@
+#ifndef SYSCAL_METRICS_HISTOGRAM_H_
+#define SYSCAL_METRICS_HISTOGRAM_H_
+
+#include <time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Log-bucketed latency histograms in the style of HdrHistogram.
+//
+//   metrics::Histogram latency;             // one per worker thread
+//   {
+//     metrics::ScopedLatency timer(&latency);
+//     HandleRequest();
+//   }
+//   metrics::Snapshot all;                  // at report time
+//   for (Histogram *h : per_thread) all.Merge(h->snapshot());
+//   printf("p99 %lu ns\n", all.Percentile(0.99));
+//
+// Values below 2^kSubBits get a bucket each; above that every power of two
+// is split into 2^kSubBits linear sub-buckets, so any recorded value is
+// reported within 1/2^kSubBits (6.25%) of itself across the whole uint64
+// range, in 976 fixed buckets.  Record() is a couple of relaxed atomic
+// adds with no lock, so it is safe from any thread and from signal
+// handlers; a histogram per thread keeps those adds uncontended.  Merging
+// is bucket-wise addition, so it never blocks the recorders either.
+namespace metrics {
+
+constexpr int kSubBits = 4;
+constexpr int kSub = 1 << kSubBits;
+constexpr int kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+inline int Bucket(uint64_t value) {
+  if (value < kSub) return value;
+  int e = 63 - __builtin_clzll(value);
+  return ((e - kSubBits + 1) << kSubBits) +
+         ((value >> (e - kSubBits)) & (kSub - 1));
+}
+
+// Smallest value that lands in `bucket`.
+inline uint64_t BucketLow(int bucket) {
+  if (bucket < kSub) return bucket;
+  int e = (bucket >> kSubBits) + kSubBits - 1;
+  return uint64_t(kSub + (bucket & (kSub - 1))) << (e - kSubBits);
+}
+
+// Largest value that lands in `bucket`.
+inline uint64_t BucketHigh(int bucket) { return BucketLow(bucket + 1) - 1; }
+
+inline uint64_t NowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// A plain copy of a histogram, for reading and merging.
+struct Snapshot {
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(kBuckets);
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  void Merge(const Snapshot &other) {
+    for (int b = 0; b < kBuckets; b++) buckets[b] += other.buckets[b];
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max) max = other.max;
+  }
+
+  double Mean() const { return count ? double(sum) / count : 0; }
+
+  // Upper bound of the bucket holding the q-quantile, capped at max.
+  uint64_t Percentile(double q) const {
+    if (count == 0) return 0;
+    double exact = q * count;
+    uint64_t rank = exact;
+    if (rank < exact || rank == 0) rank++;
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+      seen += buckets[b];
+      if (seen >= rank) return BucketHigh(b) < max ? BucketHigh(b) : max;
+    }
+    return max;
+  }
+};
+
+class Histogram {
+ public:
+  Histogram() = default;
+  Histogram(const Histogram &) = delete;
+  Histogram &operator=(const Histogram &) = delete;
+
+  void Record(uint64_t value) {
+    buckets_[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    RaiseMax(value);
+  }
+
+  // Adds everything `other` has recorded so far.
+  void Merge(const Histogram &other) {
+    for (int b = 0; b < kBuckets; b++) {
+      uint64_t n = other.buckets_[b].load(std::memory_order_relaxed);
+      if (n != 0) buckets_[b].fetch_add(n, std::memory_order_relaxed);
+    }
+    sum_.fetch_add(other.sum_.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+    RaiseMax(other.max_.load(std::memory_order_relaxed));
+  }
+
+  // Taken while recording goes on, so the fields may be off by the few
+  // values recorded during the copy.
+  Snapshot snapshot() const {
+    Snapshot s;
+    for (int b = 0; b < kBuckets; b++) {
+      s.buckets[b] = buckets_[b].load(std::memory_order_relaxed);
+      s.count += s.buckets[b];
+    }
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+ private:
+  void RaiseMax(uint64_t value) {
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      continue;
+  }
+
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Records the nanoseconds from construction to destruction.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram *histogram)
+      : histogram_(histogram), start_(NowNs()) {}
+  ~ScopedLatency() { histogram_->Record(NowNs() - start_); }
+
+ private:
+  Histogram *histogram_;
+  uint64_t start_;
+};
+
+}  // namespace metrics
+
+#endif  // SYSCAL_METRICS_HISTOGRAM_H_
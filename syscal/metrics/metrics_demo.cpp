@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "accounting.h"
+#include "endpoint.h"
+#include "harness.h"
+#include "histogram.h"
+
+// Runs CPU-bound and sleeping workers, a burst of short-lived threads and
+// a few children reaped from a SIGCHLD handler the way async_clean.cpp
+// does, then scrapes its own metrics endpoint and prints the report.
+// Finishes with the cost of recording, collecting and rendering.
+
+std::atomic<bool> stop{false};
+volatile uint64_t sink;
+
+// About `us` microseconds of arithmetic.
+void Burn(int us) {
+  uint64_t x = 1;
+  for (int i = 0; i < us * 300; i++) x = x * 6364136223846793005u + 1;
+  sink = x;
+}
+
+extern "C" void Reap(int) {
+  int saved = errno;
+  while (metrics::Wait4(-1, nullptr, WNOHANG) > 0) continue;
+  errno = saved;
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness bench("metrics_demo", argc, argv);
+  const char *path = argc > 1 ? argv[1] : "/tmp/metrics_demo.sock";
+  metrics::RegisterThread("main");
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = &Reap;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, nullptr);
+
+  // One histogram per worker, merged only when scraped.
+  const int kWorkers = 4;
+  std::vector<std::unique_ptr<metrics::Histogram>> latency;
+  for (int i = 0; i < kWorkers; i++)
+    latency.emplace_back(new metrics::Histogram);
+
+  // The path must hold nothing or a stale socket; a stale one is left
+  // here on purpose so that Start() has to replace it.
+  bool start_ok = true;
+  {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+    unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr);
+    close(fd);
+  }
+  metrics::Endpoint endpoint(path);
+  endpoint.AddHistogram("request_latency_ns", [&latency] {
+    metrics::Snapshot all;
+    for (const auto &h : latency) all.Merge(h->snapshot());
+    return all;
+  });
+  if (!endpoint.Start()) {
+    perror(path);
+    return 1;
+  }
+  {
+    metrics::Endpoint second(path);  // must not steal the live socket
+    start_ok &= !second.Start() && errno == EADDRINUSE;
+    std::string file = std::string(path) + ".file";
+    FILE *f = fopen(file.c_str(), "w");
+    if (f != nullptr) fclose(f);
+    metrics::Endpoint on_file(file);  // must not delete a regular file
+    start_ok &= !on_file.Start() && errno == EADDRINUSE &&
+                access(file.c_str(), F_OK) == 0;
+    unlink(file.c_str());
+  }
+  printf("stale socket replaced, live socket and regular file kept: %s\n",
+         start_ok ? "yes" : "NO");
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < kWorkers; i++) {
+    workers.emplace_back([i, &latency] {
+      bool sleeper = i % 2;
+      metrics::RegisterThread((sleeper ? "sleeper-" : "spinner-") +
+                              std::to_string(i));
+      while (!stop.load(std::memory_order_relaxed)) {
+        metrics::ScopedLatency timer(latency[i].get());
+        if (sleeper) usleep(500);
+        Burn(sleeper ? 20 : 200);
+      }
+    });
+  }
+  for (int i = 0; i < 8; i++) {
+    std::thread([] {
+      metrics::RegisterThread("batch \"nightly\"\\\n");  // needs escaping
+      Burn(5000);
+    }).join();
+  }
+  uint64_t forked = 0;
+  for (int i = 0; i < 6; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      std::vector<char> touch((i + 1) << 22, 1);  // 4..24 MB resident
+      Burn(20000 * (i + 1));
+      _exit(i);
+    }
+    if (pid > 0) forked++;
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  while (metrics::Children().totals().children < forked)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::string report = metrics::Scrape(path);  // workers still running
+  printf("%s", report.c_str());
+  bool well_formed = report.find("name=\"batch \\\"nightly\\\"\\\\\\n\"") !=
+                     std::string::npos;
+  for (size_t at = 0; at < report.size();) {  // "<series> <number>" lines
+    size_t end = report.find('\n', at);
+    std::string line = report.substr(at, end - at);
+    at = end == std::string::npos ? report.size() : end + 1;
+    if (line.empty() || line[0] == '#') continue;
+    size_t space = line.rfind(' ');
+    char *rest;
+    strtod(line.c_str() + space + 1, &rest);
+    if (space == std::string::npos || *rest != '\0') well_formed = false;
+  }
+  printf("\nreport well-formed: %s\n", well_formed ? "yes" : "NO");
+  stop = true;
+  for (std::thread &t : workers) t.join();
+
+  // Costs.  A scrape returns a report of about the size printed above.
+  printf("%zu bytes\n\n", report.size());
+  metrics::Histogram h;
+  bench.Run("histogram/record", {}, [&h](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) h.Record(i & 0xfffff);
+  });
+  metrics::Snapshot s;
+  bench.Run("histogram/snapshot_merge", {}, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) s.Merge(h.snapshot());
+  });
+  bench.Run("threads/collect", {}, [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) metrics::Threads().Collect();
+  });
+  bench.Run("endpoint/scrape", {}, [path](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) metrics::Scrape(path);
+  });
+  return well_formed && start_ok ? bench.Finish() : 1;
+}
@@ -0,0 +1,151 @@
+#ifndef SYSCAL_PLUGIN_EPOCH_H_
+#define SYSCAL_PLUGIN_EPOCH_H_
+
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Epoch-based grace periods, in the style of userspace RCU.
+//
+// A reader announces the epoch it entered in and clears it on the way out.
+// A writer that unpublished an object waits until every announced epoch is
+// newer than the unpublication before freeing it.  With membarrier(2) the
+// reader side is a plain store; the writer pays for the fence instead.
+// Without it readers fall back to a full fence.
+//
+// The first kMaxReaders threads to read get a slot of their own until they
+// exit.  Threads beyond that share one overflow slot under a mutex, which
+// holds the epoch of the oldest overflow reader; they retry for a slot of
+// their own at every outermost Lock().
+namespace epoch {
+
+constexpr int kMaxReaders = 256;
+
+class Domain {
+ public:
+  static Domain &Get() {
+    static Domain domain;
+    return domain;
+  }
+
+  // Enters a read-side section; sections nest.
+  void Lock() {
+    Reader &r = Self();
+    if (r.depth++ > 0) return;
+    if (r.slot == nullptr) Claim(&r);
+    if (r.slot != nullptr)
+      r.slot->store(epoch_.load(std::memory_order_acquire),
+                    std::memory_order_relaxed);
+    else
+      EnterOverflow();
+    if (membarrier_)
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    else
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void Unlock() {
+    Reader &r = Self();
+    if (--r.depth > 0) return;
+    if (r.slot != nullptr)
+      r.slot->store(0, std::memory_order_release);
+    else
+      ExitOverflow();
+  }
+
+  // Starts a grace period after something was unpublished.  Returns the
+  // epoch to hand to Passed().
+  uint64_t Retire() {
+    Barrier();
+    return epoch_.fetch_add(1, std::memory_order_seq_cst);
+  }
+
+  // True when no reader can still be inside a section that began at or
+  // before `retired`.
+  bool Passed(uint64_t retired) {
+    Barrier();
+    for (auto &slot : slots_) {
+      uint64_t seen = slot.value.load(std::memory_order_acquire);
+      if (seen != 0 && seen <= retired) return false;
+    }
+    uint64_t seen = overflow_.load(std::memory_order_acquire);
+    return seen == 0 || seen > retired;
+  }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> value{0};
+    std::atomic<bool> used{false};
+  };
+
+  struct Reader {
+    std::atomic<uint64_t> *slot = nullptr;
+    std::atomic<bool> *used = nullptr;
+    int depth = 0;
+    ~Reader() {
+      if (used != nullptr) used->store(false, std::memory_order_release);
+    }
+  };
+
+  Domain() {
+    membarrier_ =
+        syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                0) == 0;
+  }
+
+  Reader &Self() {
+    static thread_local Reader reader;
+    return reader;
+  }
+
+  // Leaves reader->slot null when all kMaxReaders slots are taken.
+  void Claim(Reader *reader) {
+    for (auto &slot : slots_) {
+      bool expected = false;
+      if (!slot.used.load(std::memory_order_relaxed) &&
+          slot.used.compare_exchange_strong(expected, true)) {
+        reader->slot = &slot.value;
+        reader->used = &slot.used;
+        return;
+      }
+    }
+  }
+
+  // The epoch is read under the mutex, so the first overflow reader in
+  // holds the oldest epoch of them all.  A writer may wait longer than it
+  // needs to while overflow readers keep overlapping, never too little.
+  void EnterOverflow() {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (overflow_readers_++ == 0)
+      overflow_.store(epoch_.load(std::memory_order_acquire),
+                      std::memory_order_relaxed);
+  }
+
+  void ExitOverflow() {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (--overflow_readers_ == 0) overflow_.store(0, std::memory_order_release);
+  }
+
+  // Makes every reader's announcement visible before the writer looks.
+  void Barrier() {
+    if (membarrier_)
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    else
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  std::atomic<uint64_t> epoch_{1};
+  bool membarrier_ = false;
+  Slot slots_[kMaxReaders];
+  std::mutex overflow_mutex_;
+  int overflow_readers_ = 0;
+  std::atomic<uint64_t> overflow_{0};
+};
+
+}  // namespace epoch
+
+#endif  // SYSCAL_PLUGIN_EPOCH_H_
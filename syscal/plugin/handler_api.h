@@ -0,0 +1,20 @@
+#ifndef SYSCAL_PLUGIN_HANDLER_API_H_
+#define SYSCAL_PLUGIN_HANDLER_API_H_
+
+#include <stdint.h>
+
+// Entry-point table shared by handler_plugin.cpp and its host.
+extern "C" {
+
+struct HandlerApi {
+  static constexpr uint32_t kAbiVersion = 1;
+
+  uint32_t abi_version;
+  int version;  // of the plugin build, to tell reloads apart
+  int (*handle)(int a, int b);
+};
+
+const HandlerApi *handler_entry();
+}
+
+#endif  // SYSCAL_PLUGIN_HANDLER_API_H_
@@ -0,0 +1,19 @@
+#include "handler_api.h"
+
+// Built twice, as libhandler_v1.so and libhandler_v2.so, with a different
+// PLUGIN_VERSION each.
+#ifndef PLUGIN_VERSION
+#define PLUGIN_VERSION 1
+#endif
+
+extern "C" {
+
+// The per-call entry point the Readme 1.5.2 example looks up with dlsym().
+int handle(int a, int b) { return a + b + PLUGIN_VERSION * 1000; }
+
+const HandlerApi *handler_entry() {
+  static const HandlerApi api = {HandlerApi::kAbiVersion, PLUGIN_VERSION,
+                                 &handle};
+  return &api;
+}
+}
@@ -0,0 +1,112 @@
+#include <dlfcn.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handler_api.h"
+#include "plugin_registry.h"
+
+constexpr int kCalls = 20000000;
+constexpr int kReaders = 4;
+
+using Clock = std::chrono::steady_clock;
+using HandleFn = int (*)(int, int);
+
+template <typename F>
+void Report(const char *name, F &&call) {
+  volatile int sink = 0;
+  auto start = Clock::now();
+  for (int i = 0; i < kCalls; i++) sink = sink + call(i);
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  printf("  %-34s %8.2f ns/call\n", name, elapsed.count() / kCalls);
+}
+
+// Calls through the registry from `threads` threads for `seconds`, checking
+// that every answer comes from one of the two plugin builds.
+double Throughput(PluginRegistry<HandlerApi> *registry, double seconds,
+                  std::atomic<long> *bad, int threads = kReaders) {
+  std::atomic<bool> stop{false};
+  std::atomic<long> calls{0};
+  std::vector<std::thread> readers;
+  auto start = Clock::now();
+  for (int t = 0; t < threads; t++) {
+    readers.emplace_back([&] {
+      long n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 1000; i++, n++) {
+          auto api = registry->Acquire();
+          int r = api->handle(i, 1) - i - 1;
+          if (r != 1000 && r != 2000) (*bad)++;
+        }
+      }
+      calls += n;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &t : readers) t.join();
+  return calls / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int, char *argv[]) {
+  std::string self = argv[0];
+  std::string dir = self.substr(0, self.find_last_of('/') + 1);
+  const std::string v1 = dir + "libhandler_v1.so";
+  const std::string v2 = dir + "libhandler_v2.so";
+
+  PluginRegistry<HandlerApi> registry("handler_entry");
+  if (registry.Load(v1) == -1) {
+    std::cerr << registry.error() << std::endl;
+    return 1;
+  }
+
+  void *handle = dlopen(v1.c_str(), RTLD_NOW | RTLD_LOCAL);
+  HandleFn cached = reinterpret_cast<HandleFn>(dlsym(handle, "handle"));
+
+  std::cout << "Dispatch cost, one thread:\n";
+  Report("cached function pointer", [&](int i) { return cached(i, 1); });
+  Report("registry Acquire() + call", [&](int i) {
+    auto api = registry.Acquire();
+    return api->handle(i, 1);
+  });
+  Report("dlsym() per call (Readme 1.5.2)", [&](int i) {
+    HandleFn f = reinterpret_cast<HandleFn>(dlsym(handle, "handle"));
+    return f(i, 1);
+  });
+  dlclose(handle);
+
+  std::atomic<long> bad{0};
+  std::cout << "\n" << kReaders << " reader threads:\n";
+  double steady = Throughput(&registry, 1.0, &bad);
+  printf("  %-34s %8.2f M calls/s\n", "no reloads", steady / 1e6);
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&] {
+    for (int i = 0; !stop; i++) {
+      registry.Load(i % 2 ? v1 : v2);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  size_t loads_before = registry.loaded();
+  double reloading = Throughput(&registry, 1.0, &bad);
+  // More readers than epoch slots: the rest share the overflow slot.
+  const int crowd = epoch::kMaxReaders + 64;
+  double crowded = Throughput(&registry, 1.0, &bad, crowd);
+  stop = true;
+  writer.join();
+  size_t pending = registry.Reclaim();
+
+  printf("  %-34s %8.2f M calls/s\n", "reloading every 1 ms", reloading / 1e6);
+  printf("  %-34s %8.2f M calls/s\n",
+         ("reloading, " + std::to_string(crowd) + " threads").c_str(),
+         crowded / 1e6);
+  printf("  reloads: %zu, unloaded: %zu, awaiting grace period: %zu, "
+         "wrong answers: %ld\n",
+         registry.loaded() - loads_before, registry.unloaded(), pending,
+         bad.load());
+  return bad == 0 ? 0 : 1;
+}
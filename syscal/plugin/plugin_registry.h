@@ -0,0 +1,189 @@
+#ifndef SYSCAL_PLUGIN_PLUGIN_REGISTRY_H_
+#define SYSCAL_PLUGIN_PLUGIN_REGISTRY_H_
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "epoch.h"
+
+// Hot-reloadable plugins with lock-free dispatch.
+//
+// A plugin exports one function, named by the registry, that returns its
+// entry-point table: a struct of function pointers whose first member is
+// `uint32_t abi_version`.  Load() resolves that table once with dlsym() and
+// publishes it with an atomic pointer swap; callers go through Acquire(),
+// which takes no lock and never calls into the dynamic linker.  A replaced
+// module is dlclose()d only after a grace period, once no caller can still
+// be running its code.
+//
+//   struct HandlerApi {
+//     static constexpr uint32_t kAbiVersion = 1;
+//     uint32_t abi_version;
+//     int (*handle)(int a, int b);
+//   };
+//   PluginRegistry<HandlerApi> registry("handler_entry");
+//   registry.Load("./libhandler.so");
+//   { auto api = registry.Acquire(); if (api) api->handle(1, 2); }
+template <typename Api>
+class PluginRegistry {
+ public:
+  using EntryFn = const Api *(*)();
+
+  // Read-side reference to the current module.  Keep it for the duration of
+  // a call, not across blocking operations: it holds up unloading.
+  class Ref {
+   public:
+    explicit Ref(const Api *api) : api_(api) {}
+    Ref(const Ref &) = delete;
+    Ref &operator=(const Ref &) = delete;
+    Ref(Ref &&other) : api_(other.api_), held_(other.held_) {
+      other.api_ = nullptr;
+      other.held_ = false;
+    }
+    ~Ref() {
+      if (held_) epoch::Domain::Get().Unlock();
+    }
+
+    const Api *operator->() const { return api_; }
+    const Api &operator*() const { return *api_; }
+    explicit operator bool() const { return api_ != nullptr; }
+
+   private:
+    const Api *api_;
+    bool held_ = true;  // inside a read-side section
+  };
+
+  explicit PluginRegistry(const std::string &entry_symbol)
+      : entry_symbol_(entry_symbol) {}
+  PluginRegistry(const PluginRegistry &) = delete;
+  PluginRegistry &operator=(const PluginRegistry &) = delete;
+  ~PluginRegistry() {
+    Module *last = current_.exchange(nullptr);
+    if (last != nullptr) Unload(last);
+    for (auto &r : retired_) Unload(r.module);
+  }
+
+  Ref Acquire() {
+    epoch::Domain::Get().Lock();
+    Module *m = current_.load(std::memory_order_acquire);
+    return Ref(m != nullptr ? m->api : nullptr);
+  }
+
+  // Loads `path`, checks its ABI version and makes it current.  Returns 0,
+  // or -1 with error() describing the failure; the previous module then
+  // stays in place.
+  int Load(const std::string &path) {
+    std::lock_guard<std::mutex> locker(writer_);
+    Module *m = Open(path);
+    if (m == nullptr) return -1;
+    Module *old = current_.exchange(m, std::memory_order_acq_rel);
+    if (old != nullptr)
+      retired_.push_back({old, epoch::Domain::Get().Retire()});
+    ReclaimLocked();
+    return 0;
+  }
+
+  // Unloads replaced modules whose grace period has passed.  Returns how
+  // many are still waiting.
+  size_t Reclaim() {
+    std::lock_guard<std::mutex> locker(writer_);
+    return ReclaimLocked();
+  }
+
+  size_t loaded() const { return loads_; }
+  size_t unloaded() const { return unloads_; }
+  std::string error() const {
+    std::lock_guard<std::mutex> locker(writer_);
+    return error_;
+  }
+
+ private:
+  struct Module {
+    void *handle;
+    const Api *api;
+    int fd;  // private copy of the library, see Open()
+  };
+
+  struct Retired {
+    Module *module;
+    uint64_t epoch;
+  };
+
+  // dlopen() returns the already loaded handle for a path it has seen, so a
+  // rebuilt library at the same path would never be picked up.  Each load
+  // therefore opens a private memfd copy through /proc/self/fd.
+  Module *Open(const std::string &path) {
+    int src = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src == -1) return Fail(path + ": cannot open");
+    struct stat st;
+    int fd = memfd_create("plugin", MFD_CLOEXEC);
+    bool copied = fd != -1 && fstat(src, &st) == 0 &&
+                  sendfile(fd, src, nullptr, st.st_size) == st.st_size;
+    close(src);
+    if (!copied) {
+      if (fd != -1) close(fd);
+      return Fail(path + ": cannot copy");
+    }
+
+    std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+    void *handle = dlopen(proc_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+      close(fd);
+      return Fail(dlerror());
+    }
+    auto entry =
+        reinterpret_cast<EntryFn>(dlsym(handle, entry_symbol_.c_str()));
+    const Api *api = entry != nullptr ? entry() : nullptr;
+    if (api == nullptr || api->abi_version != Api::kAbiVersion) {
+      dlclose(handle);
+      close(fd);
+      return Fail(path + ": missing entry point or wrong ABI version");
+    }
+    loads_++;
+    return new Module{handle, api, fd};
+  }
+
+  Module *Fail(const std::string &message) {
+    error_ = message;
+    return nullptr;
+  }
+
+  size_t ReclaimLocked() {
+    epoch::Domain &domain = epoch::Domain::Get();
+    size_t kept = 0;
+    for (auto &r : retired_) {
+      if (domain.Passed(r.epoch))
+        Unload(r.module);
+      else
+        retired_[kept++] = r;
+    }
+    retired_.resize(kept);
+    return kept;
+  }
+
+  void Unload(Module *m) {
+    dlclose(m->handle);
+    close(m->fd);
+    delete m;
+    unloads_++;
+  }
+
+  std::string entry_symbol_;
+  std::atomic<Module *> current_{nullptr};
+  mutable std::mutex writer_;  // serialises Load() and Reclaim()
+  std::vector<Retired> retired_;
+  std::string error_;
+  std::atomic<size_t> loads_{0}, unloads_{0};
+};
+
+#endif  // SYSCAL_PLUGIN_PLUGIN_REGISTRY_H_
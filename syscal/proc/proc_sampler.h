@@ -0,0 +1,439 @@
+#ifndef SYSCAL_PROC_PROC_SAMPLER_H_
+#define SYSCAL_PROC_PROC_SAMPLER_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Incremental /proc sampler (Readme 1.3.3) for pages that list processes,
+// memory, load and free disk (Readme 4.3).
+//
+//   procfs::Sampler sampler;                   // or "/proc/<pid>/task"
+//   sampler.Start(std::chrono::seconds(1));
+//   ...
+//   procfs::Sampler::Ref snap = sampler.Read();
+//   for (const procfs::ProcessSample &p : snap->processes) ...
+//
+// Every <dir>/<id>/stat stays open between sweeps and is re-read with
+// pread() at offset 0, so a steady-state sweep costs one syscall per entry
+// instead of open/read/close.  The directory itself is re-listed only
+// every `rescan_every` sweeps.  Parsing is done by Scanner in place, with
+// no allocation once the vectors have grown to the process count.
+//
+// Sweeps fill the back half of a double buffer and then publish it.
+// Readers pin the front half with a Ref, so what they see is one
+// consistent sweep; the next sweep waits for them, so keep Refs short.
+namespace procfs {
+
+// Forward-only parser over a byte range.  Every method returns false and
+// leaves the scanner at the end once input runs out.
+class Scanner {
+ public:
+  Scanner(const char *begin, const char *end) : p_(begin), end_(end) {}
+
+  bool AtEnd() const { return p_ >= end_; }
+
+  // Moves just past the next `c`.
+  bool SkipPast(char c) {
+    const void *hit = memchr(p_, c, end_ - p_);
+    p_ = hit ? static_cast<const char *>(hit) + 1 : end_;
+    return hit != nullptr;
+  }
+
+  // Moves just past the next occurrence of `key`.
+  bool SkipPast(const char *key) {
+    size_t len = strlen(key);
+    const void *hit = memmem(p_, end_ - p_, key, len);
+    p_ = hit ? static_cast<const char *>(hit) + len : end_;
+    return hit != nullptr;
+  }
+
+  void SkipSpaces() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n')) p_++;
+  }
+
+  // Skips `n` whitespace-separated fields.
+  bool SkipFields(int n) {
+    for (int i = 0; i < n; i++) {
+      SkipSpaces();
+      while (p_ < end_ && *p_ != ' ' && *p_ != '\n') p_++;
+    }
+    return !AtEnd();
+  }
+
+  template <typename T>
+  bool Number(T *out) {
+    SkipSpaces();
+    bool negative = p_ < end_ && *p_ == '-';
+    if (negative) p_++;
+    if (p_ >= end_ || *p_ < '0' || *p_ > '9') return false;
+    T value = 0;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9')
+      value = value * 10 + (*p_++ - '0');
+    *out = negative ? -value : value;
+    return true;
+  }
+
+  // Decimal with an optional fraction, as in /proc/loadavg.
+  bool Decimal(double *out) {
+    uint64_t whole;
+    if (!Number(&whole)) return false;
+    double value = whole, scale = 0.1;
+    if (p_ < end_ && *p_ == '.') {
+      for (p_++; p_ < end_ && *p_ >= '0' && *p_ <= '9'; p_++, scale /= 10)
+        value += (*p_ - '0') * scale;
+    }
+    *out = value;
+    return true;
+  }
+
+  // Copies the next character.
+  bool Char(char *out) {
+    SkipSpaces();
+    if (AtEnd()) return false;
+    *out = *p_++;
+    return true;
+  }
+
+ private:
+  const char *p_;
+  const char *end_;
+};
+
+struct ProcessSample {
+  pid_t pid;
+  pid_t ppid;
+  char state;
+  char comm[16];
+  uint64_t utime;       // clock ticks
+  uint64_t stime;       // clock ticks
+  uint64_t start_time;  // clock ticks after boot
+  uint64_t vsize;       // bytes
+  int64_t rss_pages;
+  int64_t threads;
+  double cpu_percent;  // since the previous sweep
+};
+
+// Parses one /proc/<pid>/stat line.  comm may itself hold spaces and
+// parentheses, so it runs from the first '(' to the last ')'.
+inline bool ParseStat(const char *buf, size_t size, ProcessSample *out) {
+  const char *end = buf + size;
+  Scanner s(buf, end);
+  if (!s.Number(&out->pid)) return false;
+  const char *open = static_cast<const char *>(memchr(buf, '(', size));
+  const char *close = static_cast<const char *>(memrchr(buf, ')', size));
+  if (open == nullptr || close == nullptr || close < open) return false;
+  size_t len = std::min<size_t>(close - open - 1, sizeof out->comm - 1);
+  memcpy(out->comm, open + 1, len);
+  out->comm[len] = '\0';
+
+  // Field numbers as in proc(5).
+  Scanner rest(close + 1, end);
+  return rest.Char(&out->state) &&         // 3
+         rest.Number(&out->ppid) &&        // 4
+         rest.SkipFields(9) &&             // 5-13
+         rest.Number(&out->utime) &&       // 14
+         rest.Number(&out->stime) &&       // 15
+         rest.SkipFields(4) &&             // 16-19
+         rest.Number(&out->threads) &&     // 20
+         rest.SkipFields(1) &&             // 21
+         rest.Number(&out->start_time) &&  // 22
+         rest.Number(&out->vsize) &&       // 23
+         rest.Number(&out->rss_pages);     // 24
+}
+
+struct SystemSample {
+  double cpu_percent;  // all CPUs, since the previous sweep
+  uint64_t mem_total_kb;
+  uint64_t mem_available_kb;
+  double load[3];
+  uint64_t disk_total_bytes;
+  uint64_t disk_free_bytes;
+};
+
+struct Snapshot {
+  uint64_t generation = 0;
+  std::chrono::steady_clock::time_point taken;
+  SystemSample system = {};
+  std::vector<ProcessSample> processes;  // sorted by pid
+};
+
+class Sampler {
+ public:
+  // `dir` holds one numeric directory per task: "/proc" for processes,
+  // "/proc/<pid>/task" for one process's threads.
+  explicit Sampler(const std::string &dir = "/proc",
+                   const std::string &disk = "/")
+      : disk_(disk), ticks_per_sec_(sysconf(_SC_CLK_TCK)) {
+    dir_fd_ = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stat_fd_ = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    meminfo_fd_ = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    loadavg_fd_ = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+  }
+  Sampler(const Sampler &) = delete;
+  Sampler &operator=(const Sampler &) = delete;
+  ~Sampler() {
+    Stop();
+    for (const Tracked &t : tracked_)
+      if (t.fd != -1) close(t.fd);
+    for (int fd : {dir_fd_, stat_fd_, meminfo_fd_, loadavg_fd_})
+      if (fd != -1) close(fd);
+  }
+
+  // A pinned snapshot.  Holding one delays the sweep after next.
+  class Ref {
+   public:
+    Ref(Ref &&other) : owner_(other.owner_), index_(other.index_) {
+      other.owner_ = nullptr;
+    }
+    Ref(const Ref &) = delete;
+    Ref &operator=(const Ref &) = delete;
+    ~Ref() {
+      if (owner_) owner_->readers_[index_].fetch_sub(1);
+    }
+    const Snapshot &operator*() const { return owner_->buffers_[index_]; }
+    const Snapshot *operator->() const { return &owner_->buffers_[index_]; }
+
+   private:
+    friend class Sampler;
+    Ref(const Sampler *owner, int index) : owner_(owner), index_(index) {}
+    const Sampler *owner_;
+    int index_;
+  };
+
+  Ref Read() const {
+    while (true) {
+      int i = front_.load();
+      readers_[i].fetch_add(1);
+      if (front_.load() == i) return Ref(this, i);
+      readers_[i].fetch_sub(1);
+    }
+  }
+
+  // One sweep.  Only one thread may call this at a time; Start() makes
+  // that thread the background one.
+  void Refresh(bool rescan = true) {
+    int back = 1 - front_.load();
+    while (readers_[back].load() != 0) std::this_thread::yield();
+    Snapshot &snap = buffers_[back];
+    auto now = std::chrono::steady_clock::now();
+    double elapsed =
+        std::chrono::duration<double>(now - last_sweep_).count();
+    last_sweep_ = now;
+
+    if (rescan) Rescan();
+    snap.processes.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < tracked_.size(); i++) {
+      Tracked &t = tracked_[i];
+      ProcessSample sample;
+      if (!Sample(&t, &sample)) {  // exited since the last listing
+        if (t.fd != -1) close(t.fd);
+        continue;
+      }
+      // An entry re-opened by id may be a younger process that reused it.
+      if (sample.start_time != t.start_time) {
+        t.start_time = sample.start_time;
+        t.prev_ticks = 0;
+      }
+      uint64_t ticks = sample.utime + sample.stime;
+      sample.cpu_percent =
+          t.prev_ticks && ticks >= t.prev_ticks && elapsed > 0
+              ? 100.0 * (ticks - t.prev_ticks) / ticks_per_sec_ / elapsed
+              : 0;
+      t.prev_ticks = ticks;
+      tracked_[kept++] = t;
+      snap.processes.push_back(sample);
+    }
+    tracked_.resize(kept);
+
+    SampleSystem(&snap.system);
+    snap.generation = ++generation_;
+    snap.taken = now;
+    front_.store(back);
+  }
+
+  // Sweeps every `period`, re-listing the directory every `rescan_every`
+  // sweeps.
+  void Start(std::chrono::milliseconds period, int rescan_every = 1) {
+    Stop();
+    stop_ = false;
+    worker_ = std::thread([this, period, rescan_every] {
+      auto next = std::chrono::steady_clock::now();
+      for (long sweep = 0;; sweep++) {
+        Refresh(sweep % rescan_every == 0);
+        next += period;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (cv_.wait_until(lock, next, [this] { return stop_; })) return;
+      }
+    });
+  }
+
+  void Stop() {
+    if (!worker_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+
+  // Entries being followed, and how many of those are re-opened every
+  // sweep because the fd limit was reached.  Sweeping thread only.
+  size_t tracked() const { return tracked_.size(); }
+  size_t untracked() const {
+    return std::count_if(tracked_.begin(), tracked_.end(),
+                         [](const Tracked &t) { return t.fd == -1; });
+  }
+
+ private:
+  struct Tracked {
+    pid_t id;
+    int fd;  // -1: over the fd limit, open per sweep
+    uint64_t prev_ticks;
+    uint64_t start_time;  // tells a reused id from the process it had
+  };
+
+  // Lists the directory with getdents64 and merges it into tracked_:
+  // new ids get an fd, vanished ones lose theirs.
+  void Rescan() {
+    listed_.clear();
+    lseek(dir_fd_, 0, SEEK_SET);
+    while (true) {
+      long n = syscall(SYS_getdents64, dir_fd_, dents_, sizeof dents_);
+      if (n <= 0) break;
+      for (long off = 0; off < n;) {
+        struct linux_dirent64 {
+          uint64_t d_ino;
+          int64_t d_off;
+          unsigned short d_reclen;
+          unsigned char d_type;
+          char d_name[];
+        } *d = reinterpret_cast<linux_dirent64 *>(dents_ + off);
+        off += d->d_reclen;
+        pid_t id;
+        Scanner s(d->d_name, d->d_name + strlen(d->d_name));
+        if (d->d_name[0] >= '1' && d->d_name[0] <= '9' && s.Number(&id))
+          listed_.push_back(id);
+      }
+    }
+    std::sort(listed_.begin(), listed_.end());
+
+    merged_.clear();
+    size_t i = 0;
+    for (pid_t id : listed_) {
+      while (i < tracked_.size() && tracked_[i].id < id) {
+        if (tracked_[i].fd != -1) close(tracked_[i].fd);
+        i++;
+      }
+      if (i < tracked_.size() && tracked_[i].id == id) {
+        merged_.push_back(tracked_[i++]);
+      } else {
+        merged_.push_back({id, OpenStat(id), 0, 0});
+      }
+    }
+    for (; i < tracked_.size(); i++)
+      if (tracked_[i].fd != -1) close(tracked_[i].fd);
+    tracked_.swap(merged_);
+  }
+
+  int OpenStat(pid_t id) {
+    char path[32];
+    snprintf(path, sizeof path, "%d/stat", id);
+    return openat(dir_fd_, path, O_RDONLY | O_CLOEXEC);
+  }
+
+  bool Sample(Tracked *t, ProcessSample *out) {
+    char buf[1024];
+    ssize_t n;
+    if (t->fd != -1) {
+      n = pread(t->fd, buf, sizeof buf, 0);
+    } else {
+      int fd = OpenStat(t->id);
+      if (fd == -1) return false;
+      n = pread(fd, buf, sizeof buf, 0);
+      close(fd);
+    }
+    return n > 0 && ParseStat(buf, n, out);
+  }
+
+  static ssize_t ReadAll(int fd, char *buf, size_t size) {
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    return n < 0 ? 0 : n;
+  }
+
+  void SampleSystem(SystemSample *out) {
+    char buf[4096];
+    ssize_t n = ReadAll(stat_fd_, buf, sizeof buf);
+    Scanner cpu(buf, buf + n);
+    uint64_t total = 0, idle = 0, value;
+    cpu.SkipPast("cpu ");
+    for (int field = 0; field < 8 && cpu.Number(&value); field++) {
+      total += value;
+      if (field == 3 || field == 4) idle += value;  // idle, iowait
+    }
+    out->cpu_percent = 0;
+    if (total > prev_cpu_total_)
+      out->cpu_percent = 100.0 - 100.0 * (idle - prev_cpu_idle_) /
+                                     (total - prev_cpu_total_);
+    prev_cpu_total_ = total;
+    prev_cpu_idle_ = idle;
+
+    n = ReadAll(meminfo_fd_, buf, sizeof buf);
+    Scanner total_kb(buf, buf + n), available_kb(buf, buf + n);
+    if (total_kb.SkipPast("MemTotal:")) total_kb.Number(&out->mem_total_kb);
+    if (available_kb.SkipPast("MemAvailable:"))
+      available_kb.Number(&out->mem_available_kb);
+
+    n = ReadAll(loadavg_fd_, buf, sizeof buf);
+    Scanner load(buf, buf + n);
+    for (double &l : out->load) load.Decimal(&l);
+
+    struct statvfs vfs;
+    if (statvfs(disk_.c_str(), &vfs) == 0) {
+      out->disk_total_bytes = vfs.f_blocks * vfs.f_frsize;
+      out->disk_free_bytes = vfs.f_bavail * vfs.f_frsize;
+    }
+  }
+
+  const std::string disk_;
+  const long ticks_per_sec_;
+  int dir_fd_, stat_fd_, meminfo_fd_, loadavg_fd_;
+
+  // Sweep state, owned by the refreshing thread.
+  std::vector<Tracked> tracked_;  // sorted by id
+  std::vector<Tracked> merged_;
+  std::vector<pid_t> listed_;
+  alignas(8) char dents_[32768];
+  uint64_t generation_ = 0;
+  uint64_t prev_cpu_total_ = 0, prev_cpu_idle_ = 0;
+  std::chrono::steady_clock::time_point last_sweep_;
+
+  Snapshot buffers_[2];
+  std::atomic<int> front_{0};
+  mutable std::atomic<int> readers_[2] = {};
+
+  std::thread worker_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+};
+
+}  // namespace procfs
+
+#endif  // SYSCAL_PROC_PROC_SAMPLER_H_
@@ -0,0 +1,141 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+#include "proc_sampler.h"
+
+// Full-table sampling cost with kThreads synthetic threads parked in this
+// process, sampled through /proc/self/task: the open/getline/istringstream
+// loop a first version of the Readme 4.3 process page would write, against
+// procfs::Sampler cold, warm with a rescan, and warm without one.  Times
+// are per sweep.
+
+constexpr int kThreads = 10000;
+
+using Clock = std::chrono::steady_clock;
+
+struct NaiveSample {
+  int pid;
+  std::string comm;
+  char state;
+  long utime, stime;
+};
+
+// Re-lists, re-opens and re-parses everything, allocating as it goes.
+size_t NaiveSweep(const std::string &dir, std::vector<NaiveSample> *out) {
+  out->clear();
+  DIR *d = opendir(dir.c_str());
+  while (struct dirent *entry = readdir(d)) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+    std::ifstream in(dir + "/" + entry->d_name + "/stat");
+    std::string line;
+    if (!std::getline(in, line)) continue;
+    std::istringstream fields(line);
+    NaiveSample s;
+    std::string skip;
+    fields >> s.pid >> s.comm >> s.state;
+    for (int i = 4; i <= 13; i++) fields >> skip;
+    fields >> s.utime >> s.stime;
+    out->push_back(s);
+  }
+  closedir(d);
+  return out->size();
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("proc_sampler_bench", argc, argv);
+  int threads = argc > 1 ? atoi(argv[1]) : kThreads;
+
+  // Park the synthetic threads on a pipe with minimal stacks.
+  int park[2];
+  pipe(park);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 * 1024);
+  std::vector<pthread_t> parked(threads);
+  int started = 0;
+  for (; started < threads; started++) {
+    if (pthread_create(&parked[started], &attr,
+                       [](void *fd) -> void * {
+                         char c;
+                         read(*static_cast<int *>(fd), &c, 1);
+                         return nullptr;
+                       },
+                       &park[0]) != 0)
+      break;
+  }
+  std::cout << started << " threads parked\n";
+
+  const std::string task_dir = "/proc/self/task";
+  const bench::Params params = {{"threads", std::to_string(started)}};
+  std::vector<NaiveSample> naive;
+  h.Run("sweep/naive", params, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) NaiveSweep(task_dir, &naive);
+  });
+
+  {
+    procfs::Sampler sampler(task_dir);
+    h.Once("sweep/sampler_first", params, 1, [&] { sampler.Refresh(); });
+    h.Run("sweep/sampler_rescan", params, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) sampler.Refresh(true);
+    });
+    h.Run("sweep/sampler_pread", params, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) sampler.Refresh(false);
+    });
+    std::cout << "  entries " << sampler.Read()->processes.size()
+              << ", without a persistent fd " << sampler.untracked() << "\n";
+  }
+
+  // Wake the parked threads: one byte each.
+  std::string bytes(started, 'x');
+  write(park[1], bytes.data(), bytes.size());
+  for (int i = 0; i < started; i++) pthread_join(parked[i], nullptr);
+
+  // The process table, refreshed in the background while a reader checks
+  // that every snapshot it pins is whole and newer than the last.
+  procfs::Sampler sampler;
+  sampler.Start(std::chrono::milliseconds(5));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t last = 0, reads = 0, torn = 0;
+  for (auto until = Clock::now() + std::chrono::milliseconds(500);
+       Clock::now() < until; reads++) {
+    procfs::Sampler::Ref snap = sampler.Read();
+    const auto &p = snap->processes;
+    auto by_pid = [](const auto &a, const auto &b) { return a.pid < b.pid; };
+    torn += snap->generation < last ||
+            !std::is_sorted(p.begin(), p.end(), by_pid);
+    last = snap->generation;
+  }
+  sampler.Stop();
+
+  procfs::Sampler::Ref snap = sampler.Read();
+  const procfs::SystemSample &sys = snap->system;
+  printf("\n%lu snapshot reads during %lu sweeps, %lu inconsistent\n", reads,
+         snap->generation, torn);
+  printf("cpu %.1f%%  mem %lu/%lu MB available  load %.2f %.2f %.2f  "
+         "disk %.1f/%.1f GB free\n",
+         sys.cpu_percent, sys.mem_available_kb / 1024, sys.mem_total_kb / 1024,
+         sys.load[0], sys.load[1], sys.load[2], sys.disk_free_bytes / 1e9,
+         sys.disk_total_bytes / 1e9);
+  std::vector<procfs::ProcessSample> top = snap->processes;
+  std::sort(top.begin(), top.end(), [](const auto &a, const auto &b) {
+    return a.rss_pages > b.rss_pages;
+  });
+  printf("%7s %7s %-16s %s %10s\n", "PID", "PPID", "COMMAND", "S", "RSS KB");
+  for (size_t i = 0; i < top.size() && i < 5; i++)
+    printf("%7d %7d %-16s %c %10ld\n", top[i].pid, top[i].ppid, top[i].comm,
+           top[i].state, top[i].rss_pages * sysconf(_SC_PAGESIZE) / 1024);
+  return torn == 0 ? h.Finish() : 1;
+}
@@ -0,0 +1,308 @@
+#ifndef SYSCAL_SYSLOG_ASYNC_SYSLOG_H_
+#define SYSCAL_SYSLOG_ASYNC_SYSLOG_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// syslog(3) without the global lock and the blocking send per message.
+//
+//   asynclog::Logger log("myapp");        // openlog("myapp", LOG_PID, ...)
+//   log.SetLogMask(LOG_UPTO(LOG_INFO));   // setlogmask()
+//   log.Log(LOG_WARNING, "disk %d%% full", 93);
+//
+// Log() checks the mask before doing anything else, then claims a slot in
+// a bounded lock-free queue and formats the RFC 5424 record straight into
+// it.  A background thread sends whatever is queued in one sendmmsg(2)
+// over a non-blocking AF_UNIX datagram socket.  When syslogd lags, the
+// socket fills, the queue fills behind it, and Log() counts a drop instead
+// of blocking the caller.
+namespace asynclog {
+
+constexpr size_t kSlotSize = 1024;
+constexpr int kBatch = 64;
+
+struct Stats {
+  uint64_t sent;
+  uint64_t dropped;      // queue full: the caller's record was discarded
+  uint64_t truncated;    // record longer than a slot, cut short
+  uint64_t send_errors;  // syslogd gone; the record was discarded
+};
+
+class Logger {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit Logger(const std::string &ident, int facility = LOG_USER,
+                  const std::string &path = "/dev/log",
+                  size_t capacity = 4096)
+      : facility_(facility & LOG_FACMASK), path_(path) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    mask_ = n - 1;
+    slots_ = new Slot[n];
+    for (size_t i = 0; i < n; i++)
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+
+    char host[64] = "-";
+    gethostname(host, sizeof host);
+    host[sizeof host - 1] = '\0';
+    // HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA
+    header_ = std::string(host) + " " + (ident.empty() ? "-" : ident) + " " +
+              std::to_string(getpid()) + " - - ";
+
+    Connect();
+    sender_ = std::thread(&Logger::SendLoop, this);
+  }
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  // Sends what is still queued, then stops.
+  ~Logger() {
+    stop_.store(true);
+    Wake();
+    sender_.join();
+    if (fd_ != -1) close(fd_);
+    delete[] slots_;
+  }
+
+  // Same meaning as setlogmask(3): 0 leaves the mask unchanged.
+  int SetLogMask(int mask) {
+    return mask ? log_mask_.exchange(mask) : log_mask_.load();
+  }
+
+  // Returns false if the record was filtered out or dropped.
+  bool Log(int priority, const char *format, ...)
+      __attribute__((format(printf, 3, 4))) {
+    if (!(log_mask_.load(std::memory_order_relaxed) &
+          LOG_MASK(LOG_PRI(priority))))
+      return false;
+
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      uint64_t seq = slot->seq.load(std::memory_order_acquire);
+      int64_t diff = static_cast<int64_t>(seq - pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    int pri = (priority & LOG_FACMASK ? priority & LOG_FACMASK : facility_) |
+              LOG_PRI(priority);
+    size_t size = FormatHeader(slot->data, pri);
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(slot->data + size, sizeof slot->data - size, format,
+                      args);
+    va_end(args);
+    if (n < 0) n = 0;
+    if (size + n >= sizeof slot->data) {
+      truncated_.fetch_add(1, std::memory_order_relaxed);
+      n = sizeof slot->data - 1 - size;
+    }
+    slot->size = size + n;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    // Pairs with the fence in Sleep(): either the sender sees this record
+    // or we see it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed)) Wake();
+    return true;
+  }
+
+  // Waits up to `timeout_ms` until everything logged before the call has
+  // been sent or discarded.  Returns false if records are still queued,
+  // e.g. because syslogd has stopped reading; they stay queued.
+  bool Flush(int timeout_ms = 1000) {
+    uint64_t target = tail_.load(std::memory_order_acquire);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    Wake();
+    while (consumed_.load(std::memory_order_acquire) < target) {
+      if (std::chrono::steady_clock::now() >= deadline) return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+  }
+
+  Stats stats() const {
+    return {sent_.load(), dropped_.load(), truncated_.load(),
+            send_errors_.load()};
+  }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> seq;
+    uint32_t size;
+    char data[kSlotSize - 16];
+  };
+
+  // "<PRI>1 2026-10-19T08:15:02.123456Z host app pid - - ".  The date part
+  // is cached per thread and rebuilt once a second.
+  size_t FormatHeader(char *out, int pri) {
+    static thread_local time_t cached_sec = -1;
+    static thread_local char cached_date[32];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec != cached_sec) {
+      struct tm tm;
+      gmtime_r(&now.tv_sec, &tm);
+      strftime(cached_date, sizeof cached_date, "%Y-%m-%dT%H:%M:%S", &tm);
+      cached_sec = now.tv_sec;
+    }
+    int n = snprintf(out, kSlotSize - 16, "<%d>1 %s.%06ldZ %s", pri,
+                     cached_date, now.tv_nsec / 1000, header_.c_str());
+    return std::min<size_t>(n, kSlotSize - 17);
+  }
+
+  void Connect() {
+    if (fd_ != -1) close(fd_);
+    fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path_.c_str(), sizeof addr.sun_path - 1);
+    if (connect(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof addr) == -1) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  void Wake() {
+    waiting_.store(0, std::memory_order_seq_cst);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&waiting_),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+
+  // Sleeps until a producer wakes us, or for at most 10 ms.
+  void Sleep() {
+    waiting_.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (Ready() == 0 && !stop_.load()) {
+      struct timespec timeout = {0, 10000000};
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&waiting_),
+              FUTEX_WAIT_PRIVATE, 1, &timeout, nullptr, 0);
+    }
+    waiting_.store(0, std::memory_order_relaxed);
+  }
+
+  // Number of published records at the head of the queue, up to kBatch.
+  int Ready() {
+    int n = 0;
+    while (n < kBatch &&
+           slots_[(head_ + n) & mask_].seq.load(std::memory_order_acquire) ==
+               head_ + n + 1)
+      n++;
+    return n;
+  }
+
+  void Release(int n) {
+    for (int i = 0; i < n; i++)
+      slots_[(head_ + i) & mask_].seq.store(head_ + i + mask_ + 1,
+                                            std::memory_order_release);
+    head_ += n;
+    consumed_.store(head_, std::memory_order_release);
+  }
+
+  void SendLoop() {
+    struct mmsghdr msgs[kBatch];
+    struct iovec iov[kBatch];
+    memset(msgs, 0, sizeof msgs);
+    for (int i = 0; i < kBatch; i++) {
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int stalls = 0;
+
+    while (true) {
+      int n = Ready();
+      if (n == 0) {
+        if (stop_.load()) return;
+        Sleep();
+        continue;
+      }
+      if (fd_ == -1) Connect();
+      if (fd_ == -1) {  // nobody listening: discard rather than pile up
+        send_errors_.fetch_add(n, std::memory_order_relaxed);
+        Release(n);
+        continue;
+      }
+
+      for (int i = 0; i < n; i++) {
+        Slot &slot = slots_[(head_ + i) & mask_];
+        iov[i] = {slot.data, slot.size};
+      }
+      int sent = sendmmsg(fd_, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sent > 0) {
+        sent_.fetch_add(sent, std::memory_order_relaxed);
+        Release(sent);
+        stalls = 0;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // syslogd is behind.  Keep the records; producers start dropping
+        // once the queue is full.  On shutdown give it a second at most.
+        struct pollfd pfd = {fd_, POLLOUT, 0};
+        poll(&pfd, 1, 10);
+        if (stop_.load() && ++stalls > 100) {
+          send_errors_.fetch_add(n, std::memory_order_relaxed);
+          Release(n);
+        }
+      } else {
+        // ECONNREFUSED and friends: syslogd restarted.  Reconnect on the
+        // next batch and drop the record that failed.
+        send_errors_.fetch_add(1, std::memory_order_relaxed);
+        Release(1);
+        close(fd_);
+        fd_ = -1;
+      }
+    }
+  }
+
+  const int facility_;
+  const std::string path_;
+  std::string header_;
+  Slot *slots_;
+  uint64_t mask_;
+  int fd_ = -1;
+
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  alignas(64) std::atomic<int> log_mask_{0xff};
+  std::atomic<uint32_t> waiting_{0};
+  alignas(64) uint64_t head_ = 0;  // sender thread only
+  std::atomic<uint64_t> consumed_{0};
+  std::atomic<bool> stop_{false};
+
+  alignas(64) std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> send_errors_{0};
+  alignas(64) std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> truncated_{0};
+
+  std::thread sender_;
+};
+
+}  // namespace asynclog
+
+#endif  // SYSCAL_SYSLOG_ASYNC_SYSLOG_H_
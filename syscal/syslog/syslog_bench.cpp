@@ -0,0 +1,243 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_syslog.h"
+#include "harness.h"
+
+// asynclog::Logger against glibc syslog() (Readme 1.1.6), both talking to a
+// datagram socket that stands in for rsyslogd.
+//
+//   syslog_bench [--private]
+//
+// glibc syslog() always writes to /dev/log, so the stand-in binds there
+// when nothing exists there yet, and removes it on every exit path.  If a
+// real syslogd owns /dev/log, or with --private, the stand-in binds a
+// path under /tmp and only asynclog is measured.
+//
+// "Keeping up" paces the producers at kPacedRate records a second in all,
+// which the stand-in absorbs without drops, so it measures delivery; the
+// lagging scenario runs the producers flat out and measures the drop path.
+
+constexpr int kCallsPerThread = 20000;
+constexpr int kThreadCounts[] = {1, 4, 8};
+constexpr int kPacedRate = 100000;
+
+using Clock = std::chrono::steady_clock;
+
+// Receives and counts datagrams.  With `lag_every` > 0 it sleeps 1 ms after
+// every `lag_every` records, like a syslogd stuck on disk I/O.
+class StandIn {
+ public:
+  explicit StandIn(const std::string &path) : path_(path) {
+    fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+    bound_ = bind(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof addr) == 0;
+    int rcvbuf = 4 << 20;
+    setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    struct timeval timeout = {0, 20000};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    receiver_ = std::thread(&StandIn::Receive, this);
+  }
+  ~StandIn() {
+    stop_ = true;
+    receiver_.join();
+    close(fd_);
+    if (bound_) unlink(path_.c_str());
+  }
+
+  bool bound() const { return bound_; }
+  long received() const { return received_; }
+  void set_lag_every(int n) { lag_every_ = n; }
+  void set_paused(bool paused) { paused_ = paused; }
+  void Reset() { received_ = 0; }
+  std::string first() {
+    std::lock_guard<std::mutex> guard(first_mutex_);
+    return first_;
+  }
+
+ private:
+  void Receive() {
+    char buf[2048];
+    while (!stop_) {
+      if (paused_) {  // a syslogd that has stopped reading
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      ssize_t n = recv(fd_, buf, sizeof buf, 0);
+      if (n <= 0) continue;
+      if (received_++ == 0) {
+        std::lock_guard<std::mutex> guard(first_mutex_);
+        first_.assign(buf, n);
+      }
+      int lag = lag_every_;
+      if (lag > 0 && received_ % lag == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  std::string path_;
+  int fd_;
+  bool bound_;
+  std::atomic<bool> stop_{false};
+  std::atomic<long> received_{0};
+  std::atomic<int> lag_every_{0};
+  std::atomic<bool> paused_{false};
+  std::mutex first_mutex_;
+  std::string first_;
+  std::thread receiver_;
+};
+
+// Runs `log(thread, i)` kCallsPerThread times on each of `threads` threads
+// and reports every call's latency to the harness, then prints the tail
+// percentiles it does not keep.  Only calls for which `log` returns true
+// count, so a fast drop does not pass for a fast delivery.  With `rate` > 0
+// the threads together issue about `rate` calls a second.
+void Measure(bench::Harness &h, const char *name, const char *syslogd,
+             int threads, int rate,
+             const std::function<bool(int, int)> &log) {
+  std::vector<std::vector<uint32_t>> samples(threads);
+  std::vector<std::thread> workers;
+  auto start = Clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      samples[t].reserve(kCallsPerThread);
+      auto interval = std::chrono::nanoseconds(
+          rate > 0 ? int64_t(1e9) * threads / rate : 0);
+      for (int i = 0; i < kCallsPerThread; i++) {
+        if (rate > 0 && i % 16 == 0)  // bursts of 16 keep sleeps coarse
+          std::this_thread::sleep_until(start + interval * i);
+        auto before = Clock::now();
+        bool delivered = log(t, i);
+        if (delivered) samples[t].push_back((Clock::now() - before).count());
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  std::vector<double> all;
+  for (auto &s : samples) all.insert(all.end(), s.begin(), s.end());
+  if (all.empty()) {
+    printf("  %s, %d threads: nothing delivered\n", name, threads);
+    return;
+  }
+  h.Add(name, {{"threads", std::to_string(threads)}, {"syslogd", syslogd}},
+        all);
+  std::sort(all.begin(), all.end());
+  auto pct = [&all](double p) { return all[(all.size() - 1) * p]; };
+  printf("    p99 %.0f ns  p99.9 %.0f ns  max %.0f ns  %.2f M calls/s\n",
+         pct(0.99), pct(0.999), all.back(),
+         threads * kCallsPerThread / elapsed.count() / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("syslog_bench", argc, argv);
+  bool private_path = argc > 1 && strcmp(argv[1], "--private") == 0;
+  std::string path = "/tmp/asynclog-" + std::to_string(getpid()) + ".sock";
+  std::unique_ptr<StandIn> stand_in;  // unbinds on every return
+  struct stat st;
+  if (!private_path && lstat("/dev/log", &st) == -1) {
+    stand_in.reset(new StandIn("/dev/log"));
+    if (stand_in->bound()) path = "/dev/log";
+  }
+  bool glibc = path == "/dev/log";
+  if (!glibc) {
+    stand_in.reset(new StandIn(path));
+    std::cout << (private_path ? "--private" : "/dev/log is in use")
+              << ": skipping glibc syslog()\n";
+  }
+
+  {
+    // Correctness: filtering, counters and the RFC 5424 shape.
+    asynclog::Logger log("syslog_bench", LOG_USER, path);
+    log.SetLogMask(LOG_UPTO(LOG_INFO));
+    for (int i = 0; i < 1000; i++) {
+      log.Log(LOG_INFO, "request %d served", i);
+      log.Log(LOG_DEBUG, "filtered %d", i);
+    }
+    bool flushed = log.Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    asynclog::Stats s = log.stats();
+    std::string first = stand_in->first();
+    bool ok = flushed && s.sent == 1000 && stand_in->received() == 1000 &&
+              first.compare(0, 6, "<14>1 ") == 0 &&
+              first.find(" syslog_bench " + std::to_string(getpid()) +
+                         " - - request 0 served") != std::string::npos;
+    std::cout << "first record: " << first << "\n"
+              << "sent " << s.sent << ", received " << stand_in->received()
+              << ", dropped " << s.dropped << ": " << (ok ? "ok" : "MISMATCH")
+              << "\n";
+    if (!ok) return 1;
+  }
+
+  {
+    // Flush() gives up on a syslogd that has stopped reading, and the
+    // records it left queued go out once syslogd resumes.
+    stand_in->Reset();
+    stand_in->set_paused(true);
+    asynclog::Logger log("syslog_bench", LOG_USER, path);
+    for (int i = 0; i < 1000; i++) log.Log(LOG_INFO, "stalled %d", i);
+    auto start = Clock::now();
+    bool gave_up = !log.Flush(100);
+    std::chrono::duration<double> waited = Clock::now() - start;
+    stand_in->set_paused(false);
+    bool drained = log.Flush(5000);
+    bool ok = gave_up && waited.count() < 1 && drained &&
+              log.stats().sent == 1000;
+    printf("Flush(100) on a stalled syslogd returned after %.0f ms, "
+           "then drained: %s\n",
+           waited.count() * 1e3, ok ? "ok" : "MISMATCH");
+    if (!ok) return 1;
+  }
+
+  for (int lag : {0, 64}) {
+    stand_in->set_lag_every(lag);
+    int rate = lag ? 0 : kPacedRate;
+    const char *syslogd = lag ? "lagging" : "paced";
+    if (lag)
+      std::cout << "\nsyslogd sleeping 1 ms every 64 records, "
+                   "producers flat out:\n";
+    else
+      std::cout << "\nsyslogd keeping up with " << kPacedRate
+                << " records/s:\n";
+    for (int threads : kThreadCounts) {
+      stand_in->Reset();
+      asynclog::Logger log("syslog_bench", LOG_USER, path);
+      Measure(h, "log/asynclog", syslogd, threads, rate, [&log](int t, int i) {
+        return log.Log(LOG_INFO, "thread %d request %d served", t, i);
+      });
+      bool flushed = log.Flush(5000);
+      asynclog::Stats s = log.stats();
+      printf("    sent %lu, dropped %lu%s\n", s.sent, s.dropped,
+             flushed ? "" : ", still queued");
+
+      if (!glibc) continue;
+      openlog("syslog_bench", LOG_PID | LOG_NDELAY, LOG_USER);
+      Measure(h, "log/glibc_syslog", syslogd, threads, rate, [](int t, int i) {
+        syslog(LOG_INFO, "thread %d request %d served", t, i);
+        return true;
+      });
+      closelog();
+    }
+  }
+
+  return h.Finish();
+}
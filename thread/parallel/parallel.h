@@ -0,0 +1,333 @@
+#ifndef THREAD_PARALLEL_PARALLEL_H_
+#define THREAD_PARALLEL_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+// Data-parallel loops on a persistent set of worker threads.
+//
+//   parallel::parallel_for(0, n, [&](size_t i) { y[i] = a * x[i] + y[i]; });
+//   uint64_t sum = parallel::parallel_reduce(v.begin(), v.end(), uint64_t{0},
+//                                            std::plus<>());
+//   parallel::parallel_inclusive_scan(v.begin(), v.end(), out.begin());
+//   parallel::parallel_sort(v.begin(), v.end());
+//
+// Threads are started once per WorkerSet; a call publishes one job, wakes
+// the workers, and the calling thread works alongside them.  Chunks are
+// handed out by guided self-scheduling: each grab takes a share of what is
+// left (never less than the grain), so early chunks are large and the tail
+// balances itself.  Per-participant partial results sit on their own cache
+// lines.  Bodies run on plain index ranges so their inner loops can be
+// vectorised, and must not throw.  A parallel call made from inside a body,
+// or while another thread's call holds the same WorkerSet, runs serially
+// on the calling thread.
+namespace parallel {
+
+constexpr size_t kDefaultGrain = 1 << 14;
+
+template <typename T>
+struct alignas(64) Padded {
+  T value;
+  bool used = false;
+};
+
+class WorkerSet {
+ public:
+  // `threads` counts the caller, so WorkerSet(4) starts three workers.
+  explicit WorkerSet(unsigned threads = std::thread::hardware_concurrency()) {
+    for (unsigned id = 0; id + 1 < std::max(threads, 1u); id++)
+      workers_.emplace_back(&WorkerSet::WorkerLoop, this, id);
+  }
+  WorkerSet(const WorkerSet &) = delete;
+  WorkerSet &operator=(const WorkerSet &) = delete;
+  ~WorkerSet() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &w : workers_) w.join();
+  }
+
+  static WorkerSet &Default() {
+    static WorkerSet set;
+    return set;
+  }
+
+  unsigned size() const { return workers_.size() + 1; }
+
+  // Calls body(lo, hi, participant) over [begin, end), where participant
+  // is in [0, size()) and no two concurrent calls share one.
+  template <typename Body>
+  void Run(size_t begin, size_t end, size_t grain, Body &&body) {
+    if (grain == 0) grain = 1;
+    // One job at a time: job_ and finished_ describe a single call.
+    std::unique_lock<std::mutex> busy(run_mutex_, std::defer_lock);
+    if (Inside() || workers_.empty() || end - begin <= grain ||
+        !busy.try_lock()) {
+      if (begin < end) body(begin, end, 0u);
+      return;
+    }
+    Job job;
+    job.run = [](void *ctx, size_t lo, size_t hi, unsigned who) {
+      (*static_cast<Body *>(ctx))(lo, hi, who);
+    };
+    job.ctx = &body;
+    job.next.store(begin, std::memory_order_relaxed);
+    job.end = end;
+    job.grain = grain;
+    job.participants = size();
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      job_ = &job;
+      finished_.store(0, std::memory_order_relaxed);
+      generation_++;
+    }
+    wake_.notify_all();
+    Drain(&job, workers_.size());
+    while (finished_.load(std::memory_order_acquire) != workers_.size())
+      std::this_thread::yield();
+  }
+
+ private:
+  struct Job {
+    void (*run)(void *, size_t, size_t, unsigned);
+    void *ctx;
+    std::atomic<size_t> next;
+    size_t end;
+    size_t grain;
+    unsigned participants;
+  };
+
+  static bool &Inside() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  static void Drain(Job *job, unsigned who) {
+    Inside() = true;
+    size_t lo = job->next.load(std::memory_order_relaxed);
+    while (lo < job->end) {
+      size_t take = std::max(job->grain,
+                             (job->end - lo) / (2 * job->participants));
+      size_t hi = std::min(job->end, lo + take);
+      if (job->next.compare_exchange_weak(lo, hi, std::memory_order_relaxed)) {
+        job->run(job->ctx, lo, hi, who);
+        lo = hi;
+      }
+    }
+    Inside() = false;
+  }
+
+  void WorkerLoop(unsigned id) {
+    uint64_t seen = 0;
+    while (true) {
+      Job *job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+        job = job_;
+      }
+      Drain(job, id);
+      finished_.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;  // held by the caller for the whole of Run()
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  uint64_t generation_ = 0;
+  Job *job_ = nullptr;
+  bool stop_ = false;
+  alignas(64) std::atomic<unsigned> finished_{0};
+};
+
+namespace detail {
+
+// Reduces n > 0 transformed elements with eight independent accumulators,
+// which the compiler turns into vector lanes for arithmetic ops.
+template <typename It, typename Op, typename Transform>
+auto ChunkReduce(It first, size_t n, Op op, Transform transform) {
+  using T = decltype(transform(*first));
+  if (n < 16) {
+    T acc = transform(first[0]);
+    for (size_t i = 1; i < n; i++) acc = op(acc, transform(first[i]));
+    return acc;
+  }
+  T acc[8];
+  for (int k = 0; k < 8; k++) acc[k] = transform(first[k]);
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8)
+    for (int k = 0; k < 8; k++) acc[k] = op(acc[k], transform(first[i + k]));
+  for (; i < n; i++) acc[0] = op(acc[0], transform(first[i]));
+  for (int k = 1; k < 8; k++) acc[0] = op(acc[0], acc[k]);
+  return acc[0];
+}
+
+// Number of elements taken from `a` in the first `d` outputs of a stable
+// merge of a[0, na) and b[0, nb).
+template <typename It, typename Compare>
+size_t CoRank(It a, size_t na, It b, size_t nb, size_t d, Compare comp) {
+  size_t lo = d > nb ? d - nb : 0, hi = std::min(d, na);
+  while (lo < hi) {
+    size_t i = lo + (hi - lo) / 2;
+    if (comp(b[d - i - 1], a[i]))
+      hi = i;
+    else
+      lo = i + 1;
+  }
+  return lo;
+}
+
+// One level of parallel_sort: merges sorted pairs of `width` pieces each
+// (out of `pieces` over n elements) from `src` into `dst`, every merge cut
+// into equal output segments by co-ranking.
+template <typename Src, typename Dst, typename Compare>
+void MergeLevel(Src src, Dst dst, size_t width, size_t pieces, size_t n,
+                Compare comp, WorkerSet &set) {
+  auto bound = [n, pieces](size_t p) { return n * p / pieces; };
+  size_t pairs = pieces / (2 * width);
+  size_t segments = std::max<size_t>(1, 4 * set.size() / pairs);
+  set.Run(0, pairs * segments, 1, [&](size_t lo, size_t hi, unsigned) {
+    for (size_t t = lo; t < hi; t++) {
+      size_t pair = t / segments, seg = t % segments;
+      size_t a0 = bound(2 * pair * width), b0 = bound((2 * pair + 1) * width);
+      size_t end = bound((2 * pair + 2) * width);
+      Src a = src + a0, b = src + b0;
+      size_t na = b0 - a0, nb = end - b0, len = na + nb;
+      size_t d0 = len * seg / segments, d1 = len * (seg + 1) / segments;
+      size_t i0 = CoRank(a, na, b, nb, d0, comp);
+      size_t i1 = CoRank(a, na, b, nb, d1, comp);
+      std::merge(a + i0, a + i1, b + (d0 - i0), b + (d1 - i1), dst + a0 + d0,
+                 comp);
+    }
+  });
+}
+
+}  // namespace detail
+
+// Calls f(i) for every i in [begin, end).
+template <typename F>
+void parallel_for(size_t begin, size_t end, F &&f, size_t grain = kDefaultGrain,
+                  WorkerSet &set = WorkerSet::Default()) {
+  set.Run(begin, end, grain, [&f](size_t lo, size_t hi, unsigned) {
+    for (size_t i = lo; i < hi; i++) f(i);
+  });
+}
+
+// Like std::transform_reduce: `op` must be associative and commutative.
+template <typename It, typename T, typename Op, typename Transform>
+T parallel_transform_reduce(It first, It last, T init, Op op,
+                            Transform transform,
+                            size_t grain = kDefaultGrain,
+                            WorkerSet &set = WorkerSet::Default()) {
+  std::vector<Padded<T>> partial(set.size());
+  set.Run(0, last - first, grain, [&](size_t lo, size_t hi, unsigned who) {
+    T chunk = detail::ChunkReduce(first + lo, hi - lo, op, transform);
+    Padded<T> &p = partial[who];
+    p.value = p.used ? op(p.value, chunk) : chunk;
+    p.used = true;
+  });
+  for (const Padded<T> &p : partial)
+    if (p.used) init = op(init, p.value);
+  return init;
+}
+
+// Like std::reduce.
+template <typename It, typename T, typename Op>
+T parallel_reduce(It first, It last, T init, Op op,
+                  size_t grain = kDefaultGrain,
+                  WorkerSet &set = WorkerSet::Default()) {
+  return parallel_transform_reduce(
+      first, last, init, op, [](const auto &x) -> T { return x; }, grain, set);
+}
+
+// Like std::inclusive_scan.  Two passes over fixed blocks: block totals in
+// parallel, a serial scan of the totals, then each block scanned from its
+// offset in parallel.
+template <typename It, typename Out, typename Op = std::plus<>>
+Out parallel_inclusive_scan(It first, It last, Out d_first, Op op = Op(),
+                            WorkerSet &set = WorkerSet::Default()) {
+  using T = typename std::iterator_traits<It>::value_type;
+  size_t n = last - first;
+  size_t blocks = std::min<size_t>(4 * set.size(), n / kDefaultGrain);
+  if (set.size() == 1 || blocks < 2)
+    return std::inclusive_scan(first, last, d_first, op);
+  auto bound = [n, blocks](size_t b) { return n * b / blocks; };
+
+  std::vector<Padded<T>> totals(blocks);
+  set.Run(0, blocks - 1, 1, [&](size_t lo, size_t hi, unsigned) {
+    for (size_t b = lo; b < hi; b++)
+      totals[b].value = detail::ChunkReduce(first + bound(b),
+                                            bound(b + 1) - bound(b), op,
+                                            [](const T &x) { return x; });
+  });
+  for (size_t b = 1; b + 1 < blocks; b++)
+    totals[b].value = op(totals[b - 1].value, totals[b].value);
+
+  set.Run(0, blocks, 1, [&](size_t lo, size_t hi, unsigned) {
+    for (size_t b = lo; b < hi; b++) {
+      It in = first + bound(b), in_end = first + bound(b + 1);
+      Out out = d_first + bound(b);
+      if (b == 0) {
+        std::inclusive_scan(in, in_end, out, op);
+      } else {
+        std::inclusive_scan(in, in_end, out, op, totals[b - 1].value);
+      }
+    }
+  });
+  return d_first + n;
+}
+
+// Like std::sort.  Sorts one piece per participant (rounded up to a power
+// of two), then merges pairs level by level.  Every merge is cut into
+// equal output segments by merge-path co-ranking, so even the last level
+// runs on all threads.  Needs n elements of scratch space.
+template <typename It, typename Compare = std::less<>>
+void parallel_sort(It first, It last, Compare comp = Compare(),
+                   WorkerSet &set = WorkerSet::Default()) {
+  using T = typename std::iterator_traits<It>::value_type;
+  size_t n = last - first;
+  size_t pieces = 1;
+  while (pieces < set.size()) pieces *= 2;
+  if (pieces == 1 || n < pieces * kDefaultGrain) {
+    std::sort(first, last, comp);
+    return;
+  }
+  auto bound = [n, pieces](size_t p) { return n * p / pieces; };
+
+  set.Run(0, pieces, 1, [&](size_t lo, size_t hi, unsigned) {
+    for (size_t p = lo; p < hi; p++)
+      std::sort(first + bound(p), first + bound(p + 1), comp);
+  });
+
+  // Levels alternate between the input and the scratch buffer, through
+  // iterators, so any random-access range works, not only contiguous ones.
+  std::vector<T> scratch(n);
+  bool in_scratch = false;
+  for (size_t width = 1; width < pieces; width *= 2) {
+    if (in_scratch)
+      detail::MergeLevel(scratch.begin(), first, width, pieces, n, comp, set);
+    else
+      detail::MergeLevel(first, scratch.begin(), width, pieces, n, comp, set);
+    in_scratch = !in_scratch;
+  }
+  if (in_scratch)
+    parallel_for(0, n, [&](size_t i) { first[i] = std::move(scratch[i]); },
+                 kDefaultGrain, set);
+}
+
+}  // namespace parallel
+
+#endif  // THREAD_PARALLEL_PARALLEL_H_
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+#include "parallel.h"
+
+// 1e8-element for_each, reduction, scan and sort against the serial
+// standard algorithms, at several worker-set sizes.  Every parallel result
+// is checked against the serial one.
+
+constexpr size_t kElements = 100000000;
+
+// Prints the speedup over the serial run under the harness's row.
+// Returns `ok`.
+bool Report(double seconds, double serial, bool ok) {
+  if (seconds > 0 && serial > 0)
+    printf("    %.2fx serial%s\n", serial / seconds, ok ? "" : "  MISMATCH");
+  return ok;
+}
+
+// Two threads calling into one WorkerSet at once, as callers of the
+// process-wide Default() set do.  Each call must cover exactly its own
+// range and be finished when it returns; bodies yield so that workers
+// interleave with both callers even on one CPU.
+bool ConcurrentCallers(parallel::WorkerSet &set) {
+  constexpr size_t kLength = 1 << 16;
+  std::atomic<bool> ok{true};
+  auto caller = [&](uint32_t salt) {
+    std::vector<uint32_t> v(kLength);
+    for (int round = 0; round < 500; round++) {
+      std::atomic<size_t> done{0};
+      set.Run(0, kLength, 1 << 10, [&](size_t lo, size_t hi, unsigned) {
+        std::this_thread::yield();
+        for (size_t i = lo; i < hi; i++) v[i] = i * salt + round;
+        done += hi - lo;
+      });
+      if (done != kLength) ok = false;
+      for (size_t i = 0; i < kLength; i++)
+        if (v[i] != uint32_t(i * salt + round)) ok = false;
+    }
+  };
+  std::thread a(caller, 3), b(caller, 7);
+  a.join();
+  b.join();
+  return ok;
+}
+
+// parallel_sort over a non-contiguous random-access range.
+bool SortDeque(parallel::WorkerSet &set) {
+  std::mt19937 rng(7);
+  std::deque<uint32_t> d(set.size() * 4 * parallel::kDefaultGrain);
+  for (uint32_t &x : d) x = rng();
+  std::vector<uint32_t> expect(d.begin(), d.end());
+  std::sort(expect.begin(), expect.end());
+  parallel::parallel_sort(d.begin(), d.end(), std::less<>(), set);
+  return std::equal(d.begin(), d.end(), expect.begin());
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("parallel_bench", argc, argv);
+  {
+    parallel::WorkerSet set(4);
+    bool concurrent = ConcurrentCallers(set), deque = SortDeque(set);
+    printf("two concurrent callers: %s, sort of a std::deque: %s\n",
+           concurrent ? "ok" : "MISMATCH", deque ? "ok" : "MISMATCH");
+    if (!concurrent || !deque) return 1;
+  }
+
+  size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : kElements;
+  std::vector<uint32_t> data(n);
+  std::mt19937 rng(42);
+  for (uint32_t &x : data) x = rng();
+  std::vector<uint32_t> work(n), expect(n);
+
+  printf("%zu elements, %u hardware threads\n", n,
+         std::thread::hardware_concurrency());
+
+  // Serial baselines.  They also produce the expected results, so they
+  // run untimed when --filter leaves them out.
+  const std::string elements = std::to_string(n);
+  auto serial = [&](const char *name, const std::function<void()> &body) {
+    double s = h.Once(name, {{"elements", elements}}, n, body);
+    if (s == 0) body();
+    return s;
+  };
+  work = data;
+  double for_each_s = serial("for_each/std", [&] {
+    std::for_each(work.begin(), work.end(), [](uint32_t &x) { x = x * 3 + 1; });
+  });
+  expect = work;
+  uint64_t sum = 0;
+  double reduce_s = serial("reduce/std", [&] {
+    sum = std::accumulate(data.begin(), data.end(), uint64_t{0});
+  });
+  std::vector<uint32_t> scanned(n);
+  double scan_s = serial("scan/std", [&] {
+    std::inclusive_scan(data.begin(), data.end(), scanned.begin());
+  });
+  work = data;
+  double sort_s =
+      serial("sort/std", [&] { std::sort(work.begin(), work.end()); });
+  std::vector<uint32_t> sorted = work;
+
+  std::vector<unsigned> counts = {1, 2, 4};
+  if (std::thread::hardware_concurrency() > 4)
+    counts.push_back(std::thread::hardware_concurrency());
+  bool ok = true;
+  for (unsigned threads : counts) {
+    parallel::WorkerSet set(threads);
+    const bench::Params params = {{"elements", elements},
+                                  {"threads", std::to_string(threads)}};
+
+    work = data;
+    double s = h.Once("for_each/parallel", params, n, [&] {
+      parallel::parallel_for(
+          0, n, [&](size_t i) { work[i] = work[i] * 3 + 1; },
+          parallel::kDefaultGrain, set);
+    });
+    ok &= Report(s, for_each_s, s == 0 || work == expect);
+
+    uint64_t psum = 0;
+    s = h.Once("reduce/parallel", params, n, [&] {
+      psum = parallel::parallel_reduce(data.begin(), data.end(), uint64_t{0},
+                                       std::plus<>(), parallel::kDefaultGrain,
+                                       set);
+    });
+    ok &= Report(s, reduce_s, s == 0 || psum == sum);
+
+    s = h.Once("scan/parallel", params, n, [&] {
+      parallel::parallel_inclusive_scan(data.begin(), data.end(),
+                                        work.begin(), std::plus<>(), set);
+    });
+    ok &= Report(s, scan_s, s == 0 || work == scanned);
+
+    work = data;
+    s = h.Once("sort/parallel", params, n, [&] {
+      parallel::parallel_sort(work.begin(), work.end(), std::less<>(), set);
+    });
+    ok &= Report(s, sort_s, s == 0 || work == sorted);
+  }
+  return ok ? h.Finish() : 1;
+}
@@ -0,0 +1,290 @@
+#ifndef THREAD_PIPELINE_PIPELINE_H_
+#define THREAD_PIPELINE_PIPELINE_H_
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.h"
+
+// In-process stage pipeline: one thread per stage, SPSC rings in between.
+//
+//   pipeline::Pipeline p =
+//       pipeline::From<Line>("read", [&](Line *l) { return Next(l); })
+//           .Then("parse", [](Line &&l) { return Parse(l); })
+//           .Then("transform", Transform, /*fuse=*/true)
+//           .Sink("write", [&](Record &&r) { Write(r); });
+//   p.Start();
+//   p.Join();
+//   for (const pipeline::StageMetrics &m : p.metrics()) ...
+//
+// Unfused stages get their own thread, fed by a bounded SpscRing.  Items
+// cross a ring in batches: the upstream thread collects up to kBatch
+// before pushing, and flushes whatever it has at the end of each batch it
+// consumed itself, so a slow trickle is not held back waiting for a full
+// batch.  A full ring blocks the thread that feeds it, which is how
+// backpressure travels back to the source.  A fused stage runs inline in
+// the thread of the stage before it -- no ring, no hand-off -- which pays
+// off when a stage is too cheap to be worth a core.
+//
+// Stage functions are 1:1 maps taking their input by rvalue; they must
+// not throw.  Item types must be default-constructible and movable.
+namespace pipeline {
+
+constexpr size_t kBatch = 64;
+constexpr size_t kRingCapacity = 4096;
+
+// Where a segment sends its output: one call per item, a flush at the end
+// of every input batch, and a close at end of stream.
+template <typename T>
+struct Emitter {
+  std::function<void(T &&)> item;
+  std::function<void()> flush;
+  std::function<void()> close;
+};
+
+struct StageMetrics {
+  std::string name;
+  unsigned thread;       // stages sharing a thread were fused
+  uint64_t items;
+  double items_per_sec;  // over the pipeline's run time
+  bool queued;           // fed by a ring; `ring` is valid
+  RingStats ring;
+};
+
+namespace detail {
+
+struct Stage {
+  std::string name;
+  unsigned thread;
+  std::atomic<uint64_t> items{0};
+  std::function<RingStats()> ring;
+
+  // Only the stage's own thread writes, so no read-modify-write needed.
+  void Count() {
+    items.store(items.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  }
+};
+
+struct State {
+  std::vector<std::unique_ptr<Stage>> stages;
+  std::vector<std::function<void()>> bodies;  // one per thread
+  unsigned threads = 1;
+  size_t ring_capacity = kRingCapacity;
+
+  Stage *AddStage(std::string name, std::function<RingStats()> ring) {
+    stages.emplace_back(new Stage);
+    Stage *stage = stages.back().get();
+    stage->name = std::move(name);
+    stage->thread = threads - 1;
+    stage->ring = std::move(ring);
+    return stage;
+  }
+};
+
+// Emitter that batches items into `ring`.
+template <typename T>
+Emitter<T> RingWriter(std::shared_ptr<SpscRing<T>> ring) {
+  auto buffer = std::make_shared<std::vector<T>>();
+  buffer->reserve(kBatch);
+  auto flush = [ring, buffer] {
+    if (buffer->empty()) return;
+    ring->PushBatch(buffer->data(), buffer->size());
+    buffer->clear();
+  };
+  return {[buffer, flush](T &&x) {
+            buffer->push_back(std::move(x));
+            if (buffer->size() == kBatch) flush();
+          },
+          flush,
+          [ring, flush] {
+            flush();
+            ring->Close();
+          }};
+}
+
+}  // namespace detail
+
+class Pipeline {
+ public:
+  explicit Pipeline(std::shared_ptr<detail::State> state)
+      : state_(std::move(state)) {}
+  Pipeline(Pipeline &&) = default;
+  ~Pipeline() {
+    if (!threads_.empty()) Join();
+  }
+
+  unsigned threads() const { return state_->bodies.size(); }
+
+  // Starts one thread per unfused stage.  With `pin`, thread i is bound to
+  // the i-th CPU this process may run on (wrapping around).
+  void Start(bool pin = true) {
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    if (pin && sched_getaffinity(0, sizeof allowed, &allowed) == 0)
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    start_ = Clock::now();
+    for (size_t i = 0; i < state_->bodies.size(); i++) {
+      int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+      threads_.emplace_back([body = state_->bodies[i], cpu] {
+        if (cpu >= 0) {
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(cpu, &set);
+          pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        }
+        body();
+      });
+    }
+  }
+
+  // Waits for the source to run dry and every stage to drain.
+  void Join() {
+    for (std::thread &t : threads_) t.join();
+    threads_.clear();
+    end_ = Clock::now();
+  }
+
+  double seconds() const {
+    Clock::time_point end = threads_.empty() ? end_ : Clock::now();
+    return std::chrono::duration<double>(end - start_).count();
+  }
+
+  // Safe while running; every counter is exact once Join() returns.
+  std::vector<StageMetrics> metrics() const {
+    double s = seconds();
+    std::vector<StageMetrics> out;
+    for (const auto &stage : state_->stages) {
+      StageMetrics m;
+      m.name = stage->name;
+      m.thread = stage->thread;
+      m.items = stage->items.load(std::memory_order_relaxed);
+      m.items_per_sec = s > 0 ? m.items / s : 0;
+      m.queued = static_cast<bool>(stage->ring);
+      m.ring = m.queued ? stage->ring() : RingStats{};
+      out.push_back(m);
+    }
+    return out;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::shared_ptr<detail::State> state_;
+  std::vector<std::thread> threads_;
+  Clock::time_point start_, end_;
+};
+
+// A pipeline under construction whose last stage produces T.  The stages
+// of the current (last) thread are kept as `open_`, which, given where its
+// output goes, returns that thread's body.
+template <typename T>
+class Builder {
+ public:
+  using Open = std::function<std::function<void()>(Emitter<T>)>;
+
+  Builder(std::shared_ptr<detail::State> state, Open open)
+      : state_(std::move(state)), open_(std::move(open)) {}
+
+  // Adds a stage mapping T to f(T).  Fused, it runs in the previous
+  // stage's thread; otherwise it gets its own thread and input ring.
+  template <typename F,
+            typename U = std::decay_t<std::invoke_result_t<F &, T &&>>>
+  Builder<U> Then(std::string name, F f, bool fuse = false) {
+    if (!fuse) return Split().Then(std::move(name), std::move(f), true);
+    detail::Stage *stage = state_->AddStage(std::move(name), std::move(ring_));
+    Open open = std::move(open_);
+    return Builder<U>(state_, [open, f, stage](Emitter<U> down) {
+      auto item = std::move(down.item);
+      return open({[f, stage, item](T &&x) mutable {
+                     stage->Count();
+                     item(f(std::move(x)));
+                   },
+                   std::move(down.flush), std::move(down.close)});
+    });
+  }
+
+  // Adds the final stage, which consumes items with f(T), and returns the
+  // finished pipeline ready to Start().
+  template <typename F>
+  Pipeline Sink(std::string name, F f, bool fuse = false) {
+    if (!fuse) return Split().Sink(std::move(name), std::move(f), true);
+    detail::Stage *stage = state_->AddStage(std::move(name), std::move(ring_));
+    state_->bodies.push_back(open_({[f, stage](T &&x) mutable {
+                                      stage->Count();
+                                      f(std::move(x));
+                                    },
+                                    [] {}, [] {}}));
+    return Pipeline(state_);
+  }
+
+ private:
+  template <typename>
+  friend class Builder;
+
+  // Closes the current thread with a writer into a new ring, and starts
+  // the next thread with a reader from it.
+  Builder Split() {
+    auto ring = std::make_shared<SpscRing<T>>(state_->ring_capacity);
+    state_->bodies.push_back(open_(detail::RingWriter(ring)));
+    state_->threads++;
+    Builder next(state_, [ring](Emitter<T> down) {
+      return std::function<void()>([ring, down] {
+        std::vector<T> batch(kBatch);
+        size_t n;
+        while ((n = ring->PopBatch(batch.data(), kBatch)) > 0) {
+          for (size_t i = 0; i < n; i++) down.item(std::move(batch[i]));
+          down.flush();
+        }
+        down.close();
+      });
+    });
+    next.ring_ = [ring] { return ring->stats(); };
+    return next;
+  }
+
+  std::shared_ptr<detail::State> state_;
+  Open open_;
+  std::function<RingStats()> ring_;  // input of the next stage, if any
+};
+
+// Starts a pipeline whose source thread calls next(&item) until it
+// returns false.  `ring_capacity` applies to every ring in the pipeline.
+template <typename T>
+Builder<T> From(std::string name, std::function<bool(T *)> next,
+                size_t ring_capacity = kRingCapacity) {
+  auto state = std::make_shared<detail::State>();
+  state->ring_capacity = ring_capacity;
+  detail::Stage *stage = state->AddStage(std::move(name), nullptr);
+  return Builder<T>(state, [next, stage](Emitter<T> down) {
+    return std::function<void()>([next, stage, down] {
+      T x;
+      size_t n;
+      do {
+        for (n = 0; n < kBatch && next(&x); n++) {
+          stage->Count();
+          down.item(std::move(x));
+        }
+        down.flush();
+      } while (n == kBatch);
+      down.close();
+    });
+  });
+}
+
+}  // namespace pipeline
+
+#endif  // THREAD_PIPELINE_PIPELINE_H_
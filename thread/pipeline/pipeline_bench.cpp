@@ -0,0 +1,238 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+#include "pipeline.h"
+
+// read -> parse -> transform -> write over 1e7 items, as an in-process
+// pipeline in several shapes and as four processes chained by kernel
+// pipes the way pipe_redirect.cpp chains two.  Every variant must end with
+// the same checksum.
+
+constexpr uint64_t kItems = 10000000;
+
+struct Line {
+  char text[32];
+};
+
+struct Record {
+  uint64_t id;
+  uint64_t value;
+};
+
+// Stage bodies, shared by all variants.
+
+void Format(uint64_t id, Line *line) {
+  // "<id> <value>\n" with value a cheap scramble of id.
+  uint64_t value = (id * 2654435761u) % 1000000007;
+  char digits[20];
+  char *p = line->text;
+  for (uint64_t x : {id, value}) {
+    int n = 0;
+    do {
+      digits[n++] = '0' + x % 10;
+      x /= 10;
+    } while (x != 0);
+    while (n > 0) *p++ = digits[--n];
+    *p++ = ' ';
+  }
+  p[-1] = '\n';
+  *p = '\0';
+}
+
+Record Parse(const Line &line) {
+  Record r = {0, 0};
+  const char *p = line.text;
+  while (*p != ' ') r.id = r.id * 10 + (*p++ - '0');
+  p++;
+  while (*p != '\n') r.value = r.value * 10 + (*p++ - '0');
+  return r;
+}
+
+Record Transform(Record r) {
+  r.value = r.value * 31 + r.id;
+  return r;
+}
+
+void Write(const Record &r, uint64_t *checksum) {
+  *checksum = (*checksum ^ r.value) * 0x100000001b3ull;
+}
+
+// Kernel pipes: one process per stage, 64 items per read/write.
+
+bool ReadFull(int fd, void *buf, size_t size, size_t *got) {
+  *got = 0;
+  while (*got < size) {
+    ssize_t n = read(fd, static_cast<char *>(buf) + *got, size - *got);
+    if (n <= 0) break;
+    *got += n;
+  }
+  return *got > 0;
+}
+
+void WriteFull(int fd, const void *buf, size_t size) {
+  for (size_t done = 0; done < size;) {
+    ssize_t n = write(fd, static_cast<const char *>(buf) + done, size - done);
+    if (n <= 0) exit(1);
+    done += n;
+  }
+}
+
+template <typename In, typename Out, typename F>
+void PipeStage(int in, int out, F f) {
+  In batch[pipeline::kBatch];
+  Out result[pipeline::kBatch];
+  size_t got;
+  while (ReadFull(in, batch, sizeof batch, &got)) {
+    size_t n = got / sizeof(In);
+    for (size_t i = 0; i < n; i++) result[i] = f(batch[i]);
+    WriteFull(out, result, n * sizeof(Out));
+  }
+}
+
+uint64_t RunPipes(uint64_t items) {
+  int a[2], b[2], c[2];
+  pipe(a);
+  pipe(b);
+  pipe(c);
+  pid_t pids[3];
+  if ((pids[0] = fork()) == 0) {  // read
+    close(a[0]);
+    Line batch[pipeline::kBatch];
+    for (uint64_t id = 0; id < items;) {
+      size_t n = 0;
+      for (; n < pipeline::kBatch && id < items; n++) Format(id++, &batch[n]);
+      WriteFull(a[1], batch, n * sizeof(Line));
+    }
+    _exit(0);
+  }
+  close(a[1]);
+  if ((pids[1] = fork()) == 0) {  // parse
+    close(b[0]);
+    PipeStage<Line, Record>(a[0], b[1], Parse);
+    _exit(0);
+  }
+  close(a[0]);
+  close(b[1]);
+  if ((pids[2] = fork()) == 0) {  // transform
+    close(c[0]);
+    PipeStage<Record, Record>(b[0], c[1], Transform);
+    _exit(0);
+  }
+  close(b[0]);
+  close(c[1]);
+  uint64_t checksum = 0;  // write, in this process
+  Record batch[pipeline::kBatch];
+  size_t got;
+  while (ReadFull(c[0], batch, sizeof batch, &got))
+    for (size_t i = 0; i < got / sizeof(Record); i++)
+      Write(batch[i], &checksum);
+  close(c[0]);
+  for (pid_t pid : pids) waitpid(pid, nullptr, 0);
+  return checksum;
+}
+
+// In-process pipeline.
+
+// Fills `*metrics`, if given, with the per-stage figures of the run.
+uint64_t RunRings(uint64_t items, bool pin, bool fuse_transform,
+                  bool fuse_all,
+                  std::vector<pipeline::StageMetrics> *metrics = nullptr) {
+  uint64_t id = 0, checksum = 0;
+  pipeline::Pipeline p =
+      pipeline::From<Line>("read",
+                           [&id, items](Line *line) {
+                             if (id == items) return false;
+                             Format(id++, line);
+                             return true;
+                           })
+          .Then("parse", [](Line &&l) { return Parse(l); }, fuse_all)
+          .Then("transform", Transform, fuse_all || fuse_transform)
+          .Sink("write", [&checksum](Record &&r) { Write(r, &checksum); },
+                fuse_all);
+  p.Start(pin);
+  // Read while the stages run, as a monitoring thread would.
+  std::vector<pipeline::StageMetrics> live;
+  if (metrics != nullptr) live = p.metrics();
+  p.Join();
+  if (metrics != nullptr) {
+    *metrics = p.metrics();
+    for (size_t i = 0; i < live.size(); i++)
+      if (live[i].ring.pushed > (*metrics)[i].ring.pushed) return 0;
+  }
+  return checksum;
+}
+
+void PrintMetrics(const std::vector<pipeline::StageMetrics> &metrics) {
+  if (metrics.empty()) return;
+  printf("    %-10s %6s %10s %12s %9s %9s %9s %9s\n", "stage", "thread",
+         "items", "items/s", "batch", "depth", "max", "full/empty");
+  for (const pipeline::StageMetrics &m : metrics) {
+    printf("    %-10s %6u %10lu %12.0f", m.name.c_str(), m.thread, m.items,
+           m.items_per_sec);
+    if (m.queued && m.ring.pops > 0)
+      printf(" %9.1f %9.1f %9lu %4lu/%lu", 1.0 * m.ring.pushed / m.ring.pops,
+             1.0 * m.ring.depth_sum / m.ring.pops, m.ring.max_depth,
+             m.ring.full_waits, m.ring.empty_waits);
+    printf("\n");
+  }
+}
+
+// Returns whether the run, if --filter let it run, produced the expected
+// checksum.
+template <typename F>
+bool Report(bench::Harness &h, const char *name, uint64_t items,
+            uint64_t expect, F run) {
+  uint64_t checksum = expect;
+  h.Once(name, {{"items", std::to_string(items)}}, items,
+         [&] { checksum = run(); });
+  if (checksum != expect) printf("    CHECKSUM MISMATCH\n");
+  return checksum == expect;
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("pipeline_bench", argc, argv);
+  uint64_t items = argc > 1 ? strtoull(argv[1], nullptr, 10) : kItems;
+
+  uint64_t expect = 0;
+  Line line;
+  for (uint64_t id = 0; id < items; id++) {
+    Format(id, &line);
+    Write(Transform(Parse(line)), &expect);
+  }
+  printf("%lu items, %u hardware threads\n", items,
+         std::thread::hardware_concurrency());
+
+  bool ok = Report(h, "pipeline/serial_loop", items, expect, [&] {
+    uint64_t checksum = 0;
+    Line l;
+    for (uint64_t id = 0; id < items; id++) {
+      Format(id, &l);
+      Write(Transform(Parse(l)), &checksum);
+    }
+    return checksum;
+  });
+  ok &= Report(h, "pipeline/pipes_4_processes", items, expect,
+               [&] { return RunPipes(items); });
+  // Stage tables are printed under the row of the run they belong to.
+  std::vector<pipeline::StageMetrics> metrics;
+  ok &= Report(h, "pipeline/rings_unpinned", items, expect,
+               [&] { return RunRings(items, false, false, false); });
+  ok &= Report(h, "pipeline/rings_pinned", items, expect,
+               [&] { return RunRings(items, true, false, false, &metrics); });
+  PrintMetrics(metrics);
+  metrics.clear();
+  ok &= Report(h, "pipeline/rings_fused_transform", items, expect,
+               [&] { return RunRings(items, true, true, false, &metrics); });
+  PrintMetrics(metrics);
+  ok &= Report(h, "pipeline/rings_fused_all", items, expect,
+               [&] { return RunRings(items, true, false, true); });
+  return ok ? h.Finish() : 1;
+}
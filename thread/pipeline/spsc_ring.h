@@ -0,0 +1,188 @@
+#ifndef THREAD_PIPELINE_SPSC_RING_H_
+#define THREAD_PIPELINE_SPSC_RING_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Bounded single-producer single-consumer ring with batch operations.
+//
+// The producer owns tail_ and the consumer head_, each on its own cache
+// line next to a private copy of the other side's index, so the shared
+// lines are only touched when the cached view runs out.  PushBatch blocks
+// while the ring is full -- that is the backpressure -- and PopBatch
+// blocks while it is empty.  Blocking spins briefly and then sleeps on a
+// futex, and the other side only issues a wake-up when someone sleeps.
+namespace pipeline {
+
+struct RingStats {
+  uint64_t pushed;
+  uint64_t pops;         // PopBatch calls that returned items
+  uint64_t depth_sum;    // backlog seen by those pops, for the mean
+  uint64_t max_depth;    // largest backlog a pop has seen
+  uint64_t full_waits;   // producer sleeps: backpressure
+  uint64_t empty_waits;  // consumer sleeps: starvation
+};
+
+template <typename T>
+class SpscRing {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit SpscRing(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    mask_ = n - 1;
+    slots_ = new T[n];
+  }
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+  ~SpscRing() { delete[] slots_; }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Moves all `n` items in, waiting for room as needed.
+  void PushBatch(T *items, size_t n) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t done = 0; done < n;) {
+      size_t room = capacity() - (tail - cached_head_);
+      if (room == 0) {
+        cached_head_ = head_.load(std::memory_order_acquire);
+        room = capacity() - (tail - cached_head_);
+      }
+      if (room == 0) {
+        Add(&full_waits_, 1);
+        Park(&producer_waiting_, [&] {
+          cached_head_ = head_.load(std::memory_order_acquire);
+          return tail - cached_head_ < capacity();
+        });
+        continue;
+      }
+      size_t k = std::min(room, n - done);
+      for (size_t i = 0; i < k; i++)
+        slots_[(tail + i) & mask_] = std::move(items[done + i]);
+      tail += k;
+      done += k;
+      tail_.store(tail, std::memory_order_release);
+      Unpark(&consumer_waiting_);
+    }
+    Add(&pushed_, n);
+  }
+
+  // Moves up to `max` items out, waiting for at least one.  Returns 0 once
+  // the ring is closed and drained.
+  size_t PopBatch(T *out, size_t max) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ == head) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (cached_tail_ == head) {
+        Add(&empty_waits_, 1);
+        Park(&consumer_waiting_, [&] {
+          cached_tail_ = tail_.load(std::memory_order_acquire);
+          return cached_tail_ != head ||
+                 closed_.load(std::memory_order_acquire);
+        });
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        if (cached_tail_ == head) return 0;  // closed
+      }
+    }
+    size_t depth = cached_tail_ - head;
+    Add(&depth_sum_, depth);
+    if (depth > max_depth_.load(std::memory_order_relaxed))
+      max_depth_.store(depth, std::memory_order_relaxed);
+    size_t k = std::min(depth, max);
+    for (size_t i = 0; i < k; i++)
+      out[i] = std::move(slots_[(head + i) & mask_]);
+    head_.store(head + k, std::memory_order_release);
+    Unpark(&producer_waiting_);
+    Add(&pops_, 1);
+    return k;
+  }
+
+  // Producer side: no more pushes.  The consumer drains what is left.
+  void Close() {
+    closed_.store(true, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Wake(&consumer_waiting_);
+  }
+
+  // Safe to call from any thread at any time; exact once both sides have
+  // stopped, a snapshot of slightly different moments while running.
+  RingStats stats() const {
+    auto get = [](const std::atomic<uint64_t> &c) {
+      return c.load(std::memory_order_relaxed);
+    };
+    return {get(pushed_),    get(pops_),       get(depth_sum_),
+            get(max_depth_), get(full_waits_), get(empty_waits_)};
+  }
+
+ private:
+  static constexpr int kSpins = 128;
+
+  // Counters have a single writer, so a relaxed load and store do; no
+  // locked read-modify-write on the hot path.
+  static void Add(std::atomic<uint64_t> *counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n,
+                   std::memory_order_relaxed);
+  }
+
+  template <typename Ready>
+  static void Park(std::atomic<uint32_t> *waiting, Ready ready) {
+    for (int i = 0; i < kSpins; i++) {
+      if (ready()) return;
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    while (true) {
+      waiting->store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) break;
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(waiting),
+              FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+    waiting->store(0, std::memory_order_relaxed);
+  }
+
+  static void Unpark(std::atomic<uint32_t> *waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting->load(std::memory_order_relaxed)) Wake(waiting);
+  }
+
+  static void Wake(std::atomic<uint32_t> *waiting) {
+    waiting->store(0, std::memory_order_relaxed);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(waiting),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+
+  T *slots_;
+  uint64_t mask_;
+
+  // Consumer's line.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  uint64_t cached_tail_ = 0;
+  std::atomic<uint64_t> pops_{0};
+  std::atomic<uint64_t> depth_sum_{0};
+  std::atomic<uint64_t> max_depth_{0};
+  std::atomic<uint64_t> empty_waits_{0};
+
+  // Producer's line.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  uint64_t cached_head_ = 0;
+  std::atomic<uint64_t> pushed_{0};
+  std::atomic<uint64_t> full_waits_{0};
+
+  // Sleep flags, read by the other side after every batch.
+  alignas(64) std::atomic<uint32_t> consumer_waiting_{0};
+  std::atomic<uint32_t> producer_waiting_{0};
+  std::atomic<bool> closed_{false};
+};
+
+}  // namespace pipeline
+
+#endif  // THREAD_PIPELINE_SPSC_RING_H_
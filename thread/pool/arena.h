@@ -0,0 +1,133 @@
+#ifndef THREAD_POOL_ARENA_H_
+#define THREAD_POOL_ARENA_H_
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "object_pool.h"
+
+// Request-scoped bump allocator.
+//
+//   pool::Arena arena;
+//   for each request:
+//     Job *job = arena.New<Job>(x, y);
+//     char *scratch = static_cast<char *>(arena.Allocate(n));
+//     ...
+//     arena.Reset();   // destroys everything at once, keeps the chunks
+//
+// An arena belongs to one thread at a time.  Allocation is a pointer bump;
+// there is no per-object free.  Reset() runs the destructors of non-trivial
+// objects in reverse order and rewinds to the first chunk, so a steady
+// workload stops mapping memory after its first request.  Chunks are
+// kChunkBytes (NUMA-local under pool::SetNumaLocal) and unmapped only when
+// the arena is destroyed.
+namespace pool {
+
+class Arena {
+ public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() {
+    Reset();
+    for (Chunk *c = first_; c != nullptr;) {
+      Chunk *next = c->next;
+      munmap(c, c->size);
+      c = next;
+    }
+  }
+
+  void *Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(cursor_) + align - 1) &
+                  ~(uintptr_t{align} - 1);
+    if (cursor_ == nullptr || p + size > reinterpret_cast<uintptr_t>(end_)) {
+      NextChunk(size + align);
+      p = (reinterpret_cast<uintptr_t>(cursor_) + align - 1) &
+          ~(uintptr_t{align} - 1);
+    }
+    cursor_ = reinterpret_cast<char *>(p + size);
+    allocated_ += size;
+    return reinterpret_cast<void *>(p);
+  }
+
+  template <typename T, typename... Args>
+  T *New(Args &&...args) {
+    if (std::is_trivially_destructible<T>::value)
+      return new (Allocate(sizeof(T), alignof(T)))
+          T(std::forward<Args>(args)...);
+    // Destructor record first, so a throwing constructor leaves nothing
+    // half-registered.
+    auto *d = static_cast<Destructor *>(
+        Allocate(sizeof(Destructor), alignof(Destructor)));
+    T *object = new (Allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    *d = {[](void *p) { static_cast<T *>(p)->~T(); }, object, destructors_};
+    destructors_ = d;
+    return object;
+  }
+
+  void Reset() {
+    for (Destructor *d = destructors_; d != nullptr; d = d->next)
+      d->destroy(d->object);
+    destructors_ = nullptr;
+    current_ = first_;
+    cursor_ = first_ ? first_->data() : nullptr;
+    end_ = first_ ? reinterpret_cast<char *>(first_) + first_->size : nullptr;
+    allocated_ = 0;
+  }
+
+  // Bytes handed out since the last Reset().
+  size_t allocated() const { return allocated_; }
+
+ private:
+  struct Chunk {
+    Chunk *next;
+    size_t size;
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  struct Destructor {
+    void (*destroy)(void *);
+    void *object;
+    Destructor *next;
+  };
+
+  // Moves to the next kept chunk, or maps one that fits `need` bytes.
+  void NextChunk(size_t need) {
+    Chunk *next = current_ ? current_->next : first_;
+    while (next != nullptr && next->size - sizeof(Chunk) < need)
+      next = next->next;  // too small for this request; skip it
+    if (next == nullptr) {
+      size_t size = kChunkBytes;
+      while (size - sizeof(Chunk) < need) size *= 2;
+      next = static_cast<Chunk *>(MapChunk(size));
+      next->size = size;
+      next->next = nullptr;
+      if (last_ != nullptr)
+        last_->next = next;
+      else
+        first_ = next;
+      last_ = next;
+    }
+    current_ = next;
+    cursor_ = next->data();
+    end_ = reinterpret_cast<char *>(next) + next->size;
+  }
+
+  Chunk *first_ = nullptr;
+  Chunk *last_ = nullptr;
+  Chunk *current_ = nullptr;
+  char *cursor_ = nullptr;
+  char *end_ = nullptr;
+  Destructor *destructors_ = nullptr;
+  size_t allocated_ = 0;
+};
+
+}  // namespace pool
+
+#endif  // THREAD_POOL_ARENA_H_
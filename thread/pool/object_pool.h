@@ -0,0 +1,250 @@
+#ifndef THREAD_POOL_OBJECT_POOL_H_
+#define THREAD_POOL_OBJECT_POOL_H_
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Typed object pools for per-task objects like the Worker every thread
+// example allocates with new.
+//
+//   class Worker : public pool::Pooled<Worker> { ... };
+//   Worker *w = new Worker{i, a, b};   // served by ObjectPool<Worker>
+//   delete w;
+//
+// ObjectPool<T> keeps a free list per thread.  Allocation and release
+// touch only that list; every kBatch objects one batch moves to or from a
+// global depot under a mutex.  Objects may be freed on any thread: they
+// join that thread's list and reach the others through the depot.  Pages
+// come from mmap in kChunkBytes chunks (larger for types too big to fit
+// kBatch of them) and are never returned to the system, so a pool's
+// footprint is its high-water mark.  A thread that exits parks the
+// uncarved rest of its chunk in the depot, and the next thread to need
+// fresh blocks carves from it before mapping another chunk.
+namespace pool {
+
+constexpr size_t kChunkBytes = 256 * 1024;
+constexpr int kBatch = 64;
+
+// With SetNumaLocal(true), chunks are bound to the memory node of the CPU
+// that maps them.  Off by default: first-touch placement already does
+// this unless objects are handed across nodes before their first write.
+inline std::atomic<bool> &NumaLocalFlag() {
+  static std::atomic<bool> flag{false};
+  return flag;
+}
+inline void SetNumaLocal(bool on) { NumaLocalFlag() = on; }
+
+// Maps `bytes` of anonymous memory, preferring the local node if asked.
+// Throws std::bad_alloc like operator new.
+inline void *MapChunk(size_t bytes) {
+  void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) throw std::bad_alloc();
+  unsigned cpu, node;
+  if (NumaLocalFlag().load(std::memory_order_relaxed) &&
+      syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < 64) {
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, &mask, 64, 0);
+  }
+  return p;
+}
+
+struct Stats {
+  size_t chunks;     // mapped from the system
+  size_t batches;    // parked in the depot
+  size_t exchanges;  // batches moved to or from the depot
+  size_t tails;      // uncarved chunk remainders of exited threads
+};
+
+template <typename T>
+class ObjectPool {
+ public:
+  template <typename... Args>
+  static T *New(Args &&...args) {
+    void *p = Allocate();
+    try {
+      return new (p) T(std::forward<Args>(args)...);
+    } catch (...) {
+      Release(p);
+      throw;
+    }
+  }
+
+  static void Delete(T *object) {
+    if (object == nullptr) return;
+    object->~T();
+    Release(object);
+  }
+
+  // Raw storage for one T.
+  static void *Allocate() {
+    Cache &cache = LocalCache();
+    if (cache.head == nullptr) Refill(&cache);
+    Block *b = cache.head;
+    cache.head = b->next;
+    cache.count--;
+    return b;
+  }
+
+  static void Release(void *p) {
+    Cache &cache = LocalCache();
+    Block *b = static_cast<Block *>(p);
+    b->next = cache.head;
+    cache.head = b;
+    if (++cache.count >= 2 * kBatch) Spill(&cache, kBatch);
+  }
+
+  static Stats stats() {
+    Depot &depot = GetDepot();
+    std::lock_guard<std::mutex> guard(depot.mutex);
+    return {depot.chunks, depot.batches.size(), depot.exchanges,
+            depot.tails.size()};
+  }
+
+ private:
+  union Block {
+    Block *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  struct Batch {
+    Block *head;
+    int count;
+  };
+
+  // At least one whole batch per chunk, however large T is.
+  static constexpr size_t kChunk =
+      kChunkBytes > kBatch * sizeof(Block) ? kChunkBytes
+                                           : kBatch * sizeof(Block);
+
+  // Blocks [begin, end) of a chunk that were never handed out.
+  struct Tail {
+    Block *begin;
+    Block *end;
+  };
+
+  struct Depot {
+    std::mutex mutex;
+    std::vector<Batch> batches;
+    std::vector<Tail> tails;
+    size_t chunks = 0;
+    size_t exchanges = 0;
+  };
+
+  // Per-thread free list plus the uncarved rest of the thread's last
+  // chunk.  Whatever is left goes back to the depot when the thread exits.
+  struct Cache {
+    Block *head = nullptr;
+    int count = 0;
+    Block *bump = nullptr;
+    Block *bump_end = nullptr;
+
+    ~Cache() {
+      while (count > 0) Spill(this, count < kBatch ? count : kBatch);
+      if (bump != bump_end) {  // never touched: park it as a range
+        Depot &depot = GetDepot();
+        std::lock_guard<std::mutex> guard(depot.mutex);
+        depot.tails.push_back({bump, bump_end});
+      }
+    }
+  };
+
+  static Depot &GetDepot() {
+    static Depot *depot = new Depot;  // outlives every thread's Cache
+    return *depot;
+  }
+
+  static Cache &LocalCache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+
+  static void Refill(Cache *cache) {
+    Depot &depot = GetDepot();
+    {
+      std::lock_guard<std::mutex> guard(depot.mutex);
+      if (!depot.batches.empty()) {
+        Batch batch = depot.batches.back();
+        depot.batches.pop_back();
+        depot.exchanges++;
+        cache->head = batch.head;
+        cache->count = batch.count;
+        return;
+      }
+    }
+    // Depot empty: carve a batch from this thread's chunk.
+    for (int i = 0; i < kBatch; i++) {
+      if (cache->bump == cache->bump_end) NextChunk(cache);
+      Block *b = cache->bump++;
+      b->next = cache->head;
+      cache->head = b;
+      cache->count++;
+    }
+  }
+
+  // Points the cache's bump range at an exited thread's tail, else at a
+  // freshly mapped chunk.
+  static void NextChunk(Cache *cache) {
+    Depot &depot = GetDepot();
+    {
+      std::lock_guard<std::mutex> guard(depot.mutex);
+      if (!depot.tails.empty()) {
+        Tail tail = depot.tails.back();
+        depot.tails.pop_back();
+        cache->bump = tail.begin;
+        cache->bump_end = tail.end;
+        return;
+      }
+    }
+    cache->bump = static_cast<Block *>(MapChunk(kChunk));
+    cache->bump_end = cache->bump + kChunk / sizeof(Block);
+    std::lock_guard<std::mutex> guard(depot.mutex);
+    depot.chunks++;
+  }
+
+  // Moves the first `n` blocks of the cache to the depot as one batch.
+  static void Spill(Cache *cache, int n) {
+    Block *first = cache->head;
+    Block *last = first;
+    for (int i = 1; i < n; i++) last = last->next;
+    cache->head = last->next;
+    cache->count -= n;
+    last->next = nullptr;
+
+    Depot &depot = GetDepot();
+    std::lock_guard<std::mutex> guard(depot.mutex);
+    depot.batches.push_back({first, n});
+    depot.exchanges++;
+  }
+};
+
+// Routes `new Derived(...)` and `delete p` to ObjectPool<Derived>.  Sizes
+// other than sizeof(Derived) (a further-derived class) fall back to the
+// global heap.
+template <typename Derived>
+class Pooled {
+ public:
+  static void *operator new(size_t size) {
+    if (size != sizeof(Derived)) return ::operator new(size);
+    return ObjectPool<Derived>::Allocate();
+  }
+  static void operator delete(void *p, size_t size) {
+    if (p == nullptr) return;
+    if (size != sizeof(Derived)) return ::operator delete(p);
+    ObjectPool<Derived>::Release(p);
+  }
+};
+
+}  // namespace pool
+
+#endif  // THREAD_POOL_OBJECT_POOL_H_
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "arena.h"
+#include "harness.h"
+#include "object_pool.h"
+
+// Per-task Worker allocation, as in with_args.cpp and promise.cpp, at 1 to
+// 64 threads.  Each thread keeps a window of kWindow live workers and
+// replaces the oldest one per operation.  Every variant and thread count
+// runs in a fresh child so its peak RSS is its own; the harness times the
+// child from fork to exit.
+
+constexpr int kOpsPerThread = 1000000;
+constexpr int kWindow = 4096;
+constexpr int kThreadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+
+// The examples' Worker, padded to a realistic task size.
+struct HeapWorker {
+  HeapWorker(int no, int a, int b) : no(no), a(a), b(b) {}
+  int no, a, b;
+  char payload[52];
+};
+
+struct PooledWorker : pool::Pooled<PooledWorker> {
+  PooledWorker(int no, int a, int b) : no(no), a(a), b(b) {}
+  int no, a, b;
+  char payload[52];
+};
+
+template <typename W>
+void NewDelete(int t) {
+  W *window[kWindow] = {};
+  for (int i = 0; i < kOpsPerThread; i++) {
+    W *&slot = window[i % kWindow];
+    delete slot;
+    slot = new W{t, i - 1, i + 1};
+  }
+  for (W *w : window) delete w;
+}
+
+void MallocFree(int t) {
+  HeapWorker *window[kWindow] = {};
+  for (int i = 0; i < kOpsPerThread; i++) {
+    HeapWorker *&slot = window[i % kWindow];
+    free(slot);
+    slot = static_cast<HeapWorker *>(malloc(sizeof(HeapWorker)));
+    slot->no = t;
+    slot->a = i - 1;
+    slot->b = i + 1;
+  }
+  for (HeapWorker *w : window) free(w);
+}
+
+// A request of kWindow workers, then one Reset().
+void ArenaReset(int t) {
+  pool::Arena arena;
+  for (int i = 0; i < kOpsPerThread; i++) {
+    arena.New<HeapWorker>(t, i - 1, i + 1);
+    if (i % kWindow == kWindow - 1) arena.Reset();
+  }
+}
+
+long StatusKb(const char *field) {
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  long kb = 0;
+  size_t len = strlen(field);
+  while (fgets(line, sizeof line, f))
+    if (strncmp(line, field, len) == 0) kb = atol(line + len + 1);
+  fclose(f);
+  return kb;
+}
+
+// The child measures its own peak RSS and passes it back through a pipe.
+void Run(bench::Harness &h, const char *name, int threads,
+         void (*work)(int)) {
+  int fds[2];
+  if (pipe(fds) != 0) return;
+  bool ran = h.Once(name, {{"threads", std::to_string(threads)}},
+                    uint64_t(threads) * kOpsPerThread, [&] {
+                      pid_t pid = fork();
+                      if (pid == 0) {
+                        long peak_kb = -StatusKb("VmRSS");
+                        std::vector<std::thread> workers;
+                        for (int t = 0; t < threads; t++)
+                          workers.emplace_back(work, t);
+                        for (auto &w : workers) w.join();
+                        peak_kb += StatusKb("VmHWM");
+                        write(fds[1], &peak_kb, sizeof peak_kb);
+                        _exit(0);
+                      }
+                      waitpid(pid, nullptr, 0);
+                    }) > 0;
+  long peak_kb;
+  if (ran && read(fds[0], &peak_kb, sizeof peak_kb) == sizeof peak_kb)
+    printf("    peak RSS +%ld KB\n", peak_kb);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Objects allocated on one thread and freed on another must come back to
+// the allocating thread through the depot, not pile up: the producer
+// keeps at most kWindow in flight, so the pool needs only a few chunks
+// however many objects pass through.
+struct Token : pool::Pooled<Token> {
+  explicit Token(long seq) : seq(seq) {}
+  long seq;
+  char payload[56];
+};
+
+// Larger than kChunkBytes: a chunk must still hold a whole batch.
+struct Huge {
+  char bytes[pool::kChunkBytes + 64];
+};
+
+bool CrossThreadFree() {
+  constexpr long kTokens = 1000000;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Token *> queue;
+  bool ok = true;
+  std::thread consumer([&] {
+    for (long expect = 0; expect < kTokens; expect++) {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return !queue.empty(); });
+      Token *t = queue.front();
+      queue.pop_front();
+      cv.notify_one();
+      lock.unlock();
+      if (t->seq != expect) ok = false;  // handed out twice while live
+      delete t;
+    }
+  });
+  for (long seq = 0; seq < kTokens; seq++) {
+    Token *t = new Token(seq);
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return queue.size() < kWindow; });
+    queue.push_back(t);
+    cv.notify_one();
+  }
+  consumer.join();
+  size_t chunks = pool::ObjectPool<Token>::stats().chunks;
+
+  std::vector<Huge *> huge;
+  for (int i = 0; i < 2 * pool::kBatch; i++) {
+    huge.push_back(pool::ObjectPool<Huge>::New());
+    memset(huge.back()->bytes, i, sizeof huge.back()->bytes);
+  }
+  for (int i = 0; i < 2 * pool::kBatch; i++) {
+    if (huge[i]->bytes[0] != char(i) ||
+        huge[i]->bytes[sizeof(Huge) - 1] != char(i))
+      ok = false;
+    pool::ObjectPool<Huge>::Delete(huge[i]);
+  }
+
+  printf("cross-thread free: %ld tokens through %zu chunks, objects larger "
+         "than a chunk: %s\n",
+         kTokens, chunks, ok ? "ok" : "CORRUPTED");
+  return ok && chunks <= 4;
+}
+
+// Short-lived threads that each take fresh blocks must carve on from the
+// chunks earlier threads left partly used, not map one chunk apiece.
+struct Churned : pool::Pooled<Churned> {
+  char payload[64];
+};
+
+bool ThreadChurn() {
+  constexpr int kThreads = 64;
+  std::vector<Churned *> held;  // keeps the depot empty
+  for (int i = 0; i < kThreads; i++) {
+    std::thread([&held] {
+      for (int j = 0; j < 2 * pool::kBatch; j++) held.push_back(new Churned);
+    }).join();
+  }
+  pool::Stats s = pool::ObjectPool<Churned>::stats();
+  size_t per_chunk =
+      pool::kChunkBytes / sizeof(Churned) / (2 * pool::kBatch);
+  bool ok = s.chunks <= (kThreads + per_chunk - 1) / per_chunk;
+  printf("%d short-lived threads: %zu chunks, %zu tails parked: %s\n",
+         kThreads, s.chunks, s.tails, ok ? "ok" : "LEAKED");
+  for (Churned *c : held) delete c;
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h("pool_bench", argc, argv);
+  if (argc > 1 && strcmp(argv[1], "--numa") == 0) pool::SetNumaLocal(true);
+  if (!CrossThreadFree() || !ThreadChurn()) return 1;
+  for (int threads : kThreadCounts) {
+    Run(h, "alloc/new_delete", threads, NewDelete<HeapWorker>);
+    Run(h, "alloc/malloc_free", threads, MallocFree);
+    Run(h, "alloc/object_pool", threads, NewDelete<PooledWorker>);
+    Run(h, "alloc/arena", threads, ArenaReset);
+  }
+  return h.Finish();
+}
@@ -0,0 +1,445 @@
+#ifndef THREAD_TRACE_TRACE_H_
+#define THREAD_TRACE_TRACE_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sem.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+// Scoped tracing into per-thread ring buffers.
+//
+//   void Work() {
+//     TRACE_SCOPE("work");          // one complete event, begin to end
+//     std::lock_guard<trace::Mutex> guard(mutex);   // tagged if it blocks
+//   }
+//   ...
+//   trace::Flush("traces");         // in every process, before exit
+//   trace::Merge("traces", "trace.json");   // once, in the parent
+//
+// A span costs two timestamp reads and a store into the calling thread's
+// own buffer: no locks and no shared cache lines.  Timestamps are raw TSC
+// ticks and are converted to CLOCK_MONOTONIC at Flush(), so files written
+// by separate processes line up on one timeline.  Each buffer keeps its
+// newest kBufferEvents spans.  Flush() reads buffers without stopping their
+// threads, so call it once the traced threads have been joined.
+//
+// A thread's buffer outlives it until the next Flush(), then goes to a new
+// thread.  With more than kMaxExitedBuffers exited but unflushed, new
+// threads take those over too, so thread churn cannot grow memory without
+// bound; the oldest exited threads' spans are dropped instead.
+//
+// The wait wrappers (Mutex, LockMutex, SemWait, Semop, FutexWait) try the
+// fast path first and record a "lock", "semaphore" or "futex" span only if
+// the call actually blocks.
+//
+// Building with -DNTRACE compiles TRACE_SCOPE to nothing and the wrappers
+// to the bare primitives.
+namespace trace {
+
+#ifdef NTRACE
+constexpr bool kEnabled = false;
+#else
+constexpr bool kEnabled = true;
+#endif
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS (1 << 14)
+#endif
+constexpr uint32_t kBufferEvents = TRACE_BUFFER_EVENTS;
+static_assert((kBufferEvents & (kBufferEvents - 1)) == 0,
+              "TRACE_BUFFER_EVENTS must be a power of two");
+constexpr int kMaxExitedBuffers = 64;
+
+inline uint64_t Ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+inline uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Writes `s` as the inside of a JSON string: quotes, backslashes and
+// control characters escaped, so any span or thread name stays valid.
+inline void WriteEscaped(FILE *out, const char *s) {
+  for (; *s != '\0'; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      putc(c, out);
+  }
+}
+
+struct Event {
+  uint64_t begin;
+  uint64_t end;
+  const char *name;      // string literal
+  const char *category;  // string literal
+};
+
+// One per thread, written only by its owner.  Buffers outlive their
+// threads so joined threads still show up in the trace.
+struct Buffer {
+  enum State : int { kLive, kExited, kFree };
+
+  Buffer *next = nullptr;
+  std::atomic<int> state{kLive};
+  pid_t tid = 0;
+  char thread_name[16] = {};
+  std::atomic<uint64_t> count{0};
+  Event events[kBufferEvents];
+
+  void Record(uint64_t begin, uint64_t end, const char *name,
+              const char *category) {
+    uint64_t n = count.load(std::memory_order_relaxed);
+    events[n & (kBufferEvents - 1)] = {begin, end, name, category};
+    count.store(n + 1, std::memory_order_release);
+  }
+};
+
+class Session {
+ public:
+  static Session &Get() {
+    static Session session;
+    return session;
+  }
+
+  Buffer *ThreadBuffer() {
+    Owner &owner = Mine();
+    if (owner.buffer == nullptr) {
+      Buffer *b = Reuse();
+      if (b == nullptr) {
+        b = new Buffer;
+        Buffer *head = head_.load(std::memory_order_relaxed);
+        do {
+          b->next = head;
+        } while (!head_.compare_exchange_weak(head, b,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+      }
+      b->tid = syscall(SYS_gettid);
+      owner.buffer = b;
+    }
+    return owner.buffer;
+  }
+
+  // Writes this process's events to <dir>/<pid>.trace, one Chrome trace
+  // event per line.  Returns the number of events written, or -1.
+  long Flush(const std::string &dir) {
+    uint64_t now_ticks = Ticks(), now_ns = MonotonicNs();
+    // Need some distance from the base pair for a usable tick rate.
+    while (now_ns - base_ns_ < 1000000) {
+      now_ticks = Ticks();
+      now_ns = MonotonicNs();
+    }
+    double ns_per_tick =
+        static_cast<double>(now_ns - base_ns_) / (now_ticks - base_ticks_);
+
+    std::string path = dir + "/" + std::to_string(getpid()) + ".trace";
+    FILE *out = fopen(path.c_str(), "w");
+    if (out == nullptr) return -1;
+    pid_t pid = getpid();
+    char name[32] = {};
+    FILE *comm = fopen("/proc/self/comm", "r");
+    if (comm != nullptr) {
+      if (fgets(name, sizeof name, comm) != nullptr)
+        name[strcspn(name, "\n")] = '\0';
+      fclose(comm);
+    }
+    fprintf(out,
+            "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"",
+            pid, pid);
+    WriteEscaped(out, name);
+    fprintf(out, " (%d)\"}}\n", pid);
+
+    long written = 0;
+    for (Buffer *b = head_.load(std::memory_order_acquire); b; b = b->next) {
+      if (b->thread_name[0] != '\0') {
+        fprintf(out,
+                "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"",
+                pid, b->tid);
+        WriteEscaped(out, b->thread_name);
+        fprintf(out, "\"}}\n");
+      }
+      uint64_t n = b->count.load(std::memory_order_acquire);
+      uint64_t first = n > kBufferEvents ? n - kBufferEvents : 0;
+      for (uint64_t i = first; i < n; i++) {
+        const Event &e = b->events[i & (kBufferEvents - 1)];
+        double ts = (base_ns_ + (e.begin - base_ticks_) * ns_per_tick) / 1e3;
+        double dur = (e.end - e.begin) * ns_per_tick / 1e3;
+        fprintf(out, "{\"ph\":\"X\",\"name\":\"");
+        WriteEscaped(out, e.name);
+        fprintf(out, "\",\"cat\":\"");
+        WriteEscaped(out, e.category);
+        fprintf(out,
+                "\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+                pid, b->tid, ts, dur);
+        written++;
+      }
+      int exited = Buffer::kExited;
+      if (b->state.compare_exchange_strong(exited, Buffer::kFree))
+        exited_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    fclose(out);
+    return written;
+  }
+
+ private:
+  Session() : base_ticks_(Ticks()), base_ns_(MonotonicNs()) {
+    pthread_atfork(nullptr, nullptr, [] { Get().AfterFork(); });
+  }
+
+  // Hands the buffer back when its thread exits.
+  struct Owner {
+    Buffer *buffer = nullptr;
+    ~Owner() {
+      if (buffer == nullptr) return;
+      Get().exited_.fetch_add(1, std::memory_order_relaxed);
+      buffer->state.store(Buffer::kExited, std::memory_order_release);
+    }
+  };
+
+  static Owner &Mine() {
+    static thread_local Owner owner;
+    return owner;
+  }
+
+  // A flushed buffer of an exited thread, else an unflushed one once too
+  // many have piled up, emptied and marked live; or nullptr.
+  Buffer *Reuse() {
+    bool crowded =
+        exited_.load(std::memory_order_relaxed) > kMaxExitedBuffers;
+    for (Buffer *b = head_.load(std::memory_order_acquire); b; b = b->next) {
+      int state = Buffer::kFree;
+      if (!b->state.compare_exchange_strong(state, Buffer::kLive) &&
+          !(crowded && state == Buffer::kExited &&
+            b->state.compare_exchange_strong(state, Buffer::kLive)))
+        continue;
+      if (state == Buffer::kExited)
+        exited_.fetch_sub(1, std::memory_order_relaxed);
+      b->thread_name[0] = '\0';
+      b->count.store(0, std::memory_order_relaxed);
+      return b;
+    }
+    return nullptr;
+  }
+
+  // The child has copies of every parent buffer but only the forking
+  // thread.  Keep that thread's buffer, emptied, and forget the rest;
+  // their memory is the parent's to free.
+  void AfterFork() {
+    Buffer *mine = Mine().buffer;
+    exited_.store(0, std::memory_order_relaxed);
+    if (mine != nullptr) {
+      mine->next = nullptr;
+      mine->tid = syscall(SYS_gettid);
+      mine->count.store(0, std::memory_order_relaxed);
+    }
+    head_.store(mine, std::memory_order_relaxed);
+  }
+
+  std::atomic<Buffer *> head_{nullptr};
+  std::atomic<int> exited_{0};  // buffers in state kExited
+  const uint64_t base_ticks_;
+  const uint64_t base_ns_;
+};
+
+inline void Record(uint64_t begin, uint64_t end, const char *name,
+                   const char *category) {
+  if (kEnabled)
+    Session::Get().ThreadBuffer()->Record(begin, end, name, category);
+}
+
+// Names the calling thread in the trace (at most 15 characters).
+inline void SetThreadName(const char *name) {
+  if (!kEnabled) return;
+  Buffer *b = Session::Get().ThreadBuffer();
+  strncpy(b->thread_name, name, sizeof b->thread_name - 1);
+}
+
+inline long Flush(const std::string &dir) {
+  return kEnabled ? Session::Get().Flush(dir) : 0;
+}
+
+// Joins every <dir>/*.trace into one Chrome/Perfetto JSON file and removes
+// the parts.  Returns the number of parts merged, or -1.
+inline int Merge(const std::string &dir, const std::string &out_path) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) return -1;
+  FILE *out = fopen(out_path.c_str(), "w");
+  if (out == nullptr) {
+    closedir(d);
+    return -1;
+  }
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  bool first = true;
+  int parts = 0;
+  char *line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while (struct dirent *entry = readdir(d)) {
+    size_t len = strlen(entry->d_name);
+    if (len < 6 || strcmp(entry->d_name + len - 6, ".trace") != 0) continue;
+    std::string path = dir + "/" + entry->d_name;
+    FILE *in = fopen(path.c_str(), "r");
+    if (in == nullptr) continue;
+    while ((length = getline(&line, &capacity, in)) != -1) {
+      if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+      fprintf(out, "%s%s", first ? "" : ",\n", line);
+      first = false;
+    }
+    fclose(in);
+    unlink(path.c_str());
+    parts++;
+  }
+  free(line);
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  closedir(d);
+  return parts;
+}
+
+class Scope {
+ public:
+  Scope(const char *name, const char *category = "span")
+      : name_(name), category_(category), begin_(Ticks()) {}
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+  ~Scope() { Record(begin_, Ticks(), name_, category_); }
+
+ private:
+  const char *name_;
+  const char *category_;
+  uint64_t begin_;
+};
+
+// std::mutex that records the time spent blocked in lock().  Works with
+// std::lock_guard, std::unique_lock and std::condition_variable_any.
+class Mutex {
+ public:
+  void lock() {
+    if (!kEnabled) {
+      mutex_.lock();
+      return;
+    }
+    if (mutex_.try_lock()) return;
+    uint64_t begin = Ticks();
+    mutex_.lock();
+    Record(begin, Ticks(), "lock wait", "lock");
+  }
+  bool try_lock() { return mutex_.try_lock(); }
+  void unlock() { mutex_.unlock(); }
+
+ private:
+  std::mutex mutex_;
+};
+
+inline int LockMutex(pthread_mutex_t *mutex) {
+  if (!kEnabled) return pthread_mutex_lock(mutex);
+  int rc = pthread_mutex_trylock(mutex);
+  if (rc != EBUSY) return rc;
+  uint64_t begin = Ticks();
+  rc = pthread_mutex_lock(mutex);
+  Record(begin, Ticks(), "lock wait", "lock");
+  return rc;
+}
+
+// POSIX semaphore, as in the Readme 3.3.5 job queue.
+inline int SemWait(sem_t *sem) {
+  if (!kEnabled) return sem_wait(sem);
+  if (sem_trywait(sem) == 0) return 0;
+  if (errno != EAGAIN) return -1;
+  uint64_t begin = Ticks();
+  int rc;
+  while ((rc = sem_wait(sem)) == -1 && errno == EINTR) {
+  }
+  Record(begin, Ticks(), "sem_wait", "semaphore");
+  return rc;
+}
+
+// SysV semop(2).  Only decrements and wait-for-zero can block, so only
+// those are tagged.
+inline int Semop(int semid, struct sembuf *ops, size_t nops) {
+  constexpr size_t kMaxOps = 16;
+  bool may_block = false;
+  for (size_t i = 0; i < nops; i++)
+    may_block |= ops[i].sem_op <= 0 && !(ops[i].sem_flg & IPC_NOWAIT);
+  if (!kEnabled || !may_block || nops > kMaxOps)
+    return semop(semid, ops, nops);
+
+  short flags[kMaxOps];
+  for (size_t i = 0; i < nops; i++) {
+    flags[i] = ops[i].sem_flg;
+    ops[i].sem_flg |= IPC_NOWAIT;
+  }
+  int rc = semop(semid, ops, nops);
+  for (size_t i = 0; i < nops; i++) ops[i].sem_flg = flags[i];
+  if (rc == 0 || errno != EAGAIN) return rc;
+
+  uint64_t begin = Ticks();
+  while ((rc = semop(semid, ops, nops)) == -1 && errno == EINTR) {
+  }
+  Record(begin, Ticks(), "semop", "semaphore");
+  return rc;
+}
+
+// Sleeps while *addr == expected.  A value that already differs returns
+// immediately and is not tagged.
+inline long FutexWait(std::atomic<uint32_t> *addr, uint32_t expected) {
+  if (addr->load(std::memory_order_acquire) != expected) return 0;
+  uint64_t begin = kEnabled ? Ticks() : 0;
+  long rc = syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr),
+                    FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+  if (kEnabled) Record(begin, Ticks(), "futex wait", "futex");
+  return rc;
+}
+
+inline long FutexWake(std::atomic<uint32_t> *addr, int count) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr),
+                 FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+}  // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef NTRACE
+#define TRACE_SCOPE(...) \
+  do {                   \
+  } while (0)
+#else
+// TRACE_SCOPE("name") or TRACE_SCOPE("name", "category").
+#define TRACE_SCOPE(...) \
+  ::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#endif
+
+#endif  // THREAD_TRACE_TRACE_H_
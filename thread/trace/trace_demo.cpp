@@ -0,0 +1,245 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <string>
+#include <thread>
+
+#include "harness.h"
+#include "trace.h"
+
+// Traces the tree's concurrency examples into one Chrome trace:
+// the Readme 3.3.5 job queue, the future.cpp async workers, a futex
+// handoff between two threads, and a forked child blocking on a SysV
+// semaphore.  Open out/trace.json in chrome://tracing or ui.perfetto.dev.
+
+constexpr long kOverheadSpans = 10000000;
+
+void Spin(int us) {
+  auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+  while (std::chrono::steady_clock::now() < until) {
+  }
+}
+
+// Readme 3.3.5, with the printing replaced by spans.
+struct Job {
+  Job(int x = 0, int y = 0) : x(x), y(y) {}
+  int x, y;
+};
+std::list<Job *> job_queue;
+pthread_mutex_t job_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+sem_t job_queue_count;
+
+void ProcessJob(Job *job) {
+  TRACE_SCOPE("ProcessJob");
+  Spin(200 * job->x);
+}
+
+void *DequeueJob(void *) {
+  trace::SetThreadName("dequeue");
+  while (true) {
+    Job *job = nullptr;
+    trace::SemWait(&job_queue_count);
+    trace::LockMutex(&job_queue_mutex);
+    if (!job_queue.empty()) {
+      job = job_queue.front();
+      job_queue.pop_front();
+    }
+    pthread_mutex_unlock(&job_queue_mutex);
+    if (!job) break;
+    ProcessJob(job);
+    delete job;
+  }
+  return nullptr;
+}
+
+void *EnqueueJob(void *arg) {
+  trace::SetThreadName("enqueue");
+  TRACE_SCOPE("EnqueueJob");
+  Job *job = reinterpret_cast<Job *>(arg);
+  trace::LockMutex(&job_queue_mutex);
+  job_queue.push_back(job);
+  sem_post(&job_queue_count);
+  Spin(100);  // hold the lock long enough to be contended
+  pthread_mutex_unlock(&job_queue_mutex);
+  return nullptr;
+}
+
+void JobQueue() {
+  TRACE_SCOPE("JobQueue");
+  pthread_t threads[8];
+  sem_init(&job_queue_count, 0, 0);
+  for (int i = 0; i < 5; ++i) {
+    Job *p = new Job(i + 1, (i + 1) * 2);
+    pthread_create(&threads[i], nullptr, EnqueueJob, p);
+  }
+  for (int i = 5; i < 8; ++i)
+    pthread_create(&threads[i], nullptr, DequeueJob, nullptr);
+  for (int i = 0; i < 5; ++i) pthread_join(threads[i], nullptr);
+  for (int i = 5; i < 8; ++i) sem_post(&job_queue_count);  // one stop each
+  for (int i = 5; i < 8; ++i) pthread_join(threads[i], nullptr);
+  sem_destroy(&job_queue_count);
+}
+
+// future.cpp's workers, sharing a trace::Mutex-protected total.
+void AsyncWorkers() {
+  TRACE_SCOPE("AsyncWorkers");
+  trace::Mutex mutex;
+  int total = 0;
+  std::future<int> results[8];
+  for (int i = 0; i < 8; i++) {
+    results[i] = std::async(std::launch::async, [&, i] {
+      trace::SetThreadName("async worker");
+      TRACE_SCOPE("Worker::work");
+      Spin(300);
+      std::lock_guard<trace::Mutex> guard(mutex);
+      Spin(100);
+      total += 2 * i;
+      return 2 * i;
+    });
+  }
+  for (auto &r : results) r.get();
+}
+
+// Two threads passing a token back and forth through a futex word.
+void FutexHandoff() {
+  TRACE_SCOPE("FutexHandoff");
+  std::atomic<uint32_t> turn{0};
+  auto player = [&turn](uint32_t me, const char *name) {
+    trace::SetThreadName(name);
+    for (int round = 0; round < 20; round++) {
+      uint32_t t;
+      while ((t = turn.load(std::memory_order_acquire)) != me)
+        trace::FutexWait(&turn, t);
+      Spin(50);
+      turn.store(1 - me, std::memory_order_release);
+      trace::FutexWake(&turn, 1);
+    }
+  };
+  std::thread ping(player, 0, "ping");
+  std::thread pong(player, 1, "pong");
+  ping.join();
+  pong.join();
+}
+
+// The child blocks on a SysV semaphore until the parent posts it.
+pid_t ForkSemaphoreChild(int semid) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    {
+      TRACE_SCOPE("child");
+      struct sembuf wait = {0, -1, 0};
+      trace::Semop(semid, &wait, 1);
+      TRACE_SCOPE("child work");
+      Spin(1000);
+    }
+    trace::Flush("out/trace_parts");
+    _exit(0);
+  }
+  return pid;
+}
+
+// Measured in a throwaway child so the spans stay out of the trace.  The
+// name is the same in both builds, so compare.py can diff trace_demo_off's
+// results against trace_demo's.
+void ReportOverhead(bench::Harness &h) {
+  h.Once("trace_scope/overhead", {}, kOverheadSpans, [] {
+    pid_t pid = fork();
+    if (pid == 0) {
+      for (long i = 0; i < kOverheadSpans; i++) {
+        TRACE_SCOPE("overhead");
+        asm volatile("" ::: "memory");
+      }
+      _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+  });
+}
+
+// Thread churn must not grow memory by a buffer per thread ever started.
+bool ReportChurn() {
+  pid_t pid = fork();
+  if (pid == 0) {
+    auto vm_mb = [] {
+      long pages = 0;
+      FILE *statm = fopen("/proc/self/statm", "r");
+      if (statm != nullptr) {
+        if (fscanf(statm, "%ld", &pages) != 1) pages = 0;
+        fclose(statm);
+      }
+      return pages * getpagesize() >> 20;
+    };
+    long before = vm_mb();
+    for (int i = 0; i < 2000; i++)
+      std::thread([] { TRACE_SCOPE("short-lived"); }).join();
+    long grown = vm_mb() - before;
+    printf("2000 short-lived traced threads: +%ld MB virtual\n", grown);
+    fflush(stdout);
+    _exit(grown < 512 ? 0 : 1);  // about 1 GB with a buffer per thread
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (status != 0) std::cerr << "thread churn: buffers not recycled\n";
+  return status == 0;
+}
+
+int main(int argc, char *argv[]) {
+  bench::Harness h(trace::kEnabled ? "trace_demo" : "trace_demo_off", argc,
+                   argv);
+  ReportOverhead(h);
+  bool ok = ReportChurn();
+  mkdir("out/trace_parts", 0755);
+  trace::SetThreadName("main");
+
+  int semid = semget(IPC_PRIVATE, 1, IPC_CREAT | 0600);
+  pid_t child = ForkSemaphoreChild(semid);
+
+  JobQueue();
+  AsyncWorkers();
+  FutexHandoff();
+  // Longer than any fixed line buffer; must survive Merge() in one piece.
+  static const std::string long_name(1000, 'n');
+  { TRACE_SCOPE(long_name.c_str()); }
+  { TRACE_SCOPE("quote \" backslash \\ tab \t", "odd\"name"); }
+
+  struct sembuf post = {0, 1, 0};
+  semop(semid, &post, 1);
+  waitpid(child, nullptr, 0);
+  semctl(semid, 0, IPC_RMID);
+
+  long events = trace::Flush("out/trace_parts");
+  int parts = trace::Merge("out/trace_parts", "out/trace.json");
+  rmdir("out/trace_parts");
+  std::ifstream merged("out/trace.json");
+  std::string json((std::istreambuf_iterator<char>(merged)),
+                   std::istreambuf_iterator<char>());
+  if (events < 0 || parts < 0) {
+    std::cerr << "Flush() or Merge() failed\n";
+    ok = false;
+  }
+  if (trace::kEnabled &&
+      json.find("\"name\":\"" + long_name + "\",") == std::string::npos) {
+    std::cerr << "long span name split by Merge()\n";
+    ok = false;
+  }
+  if (trace::kEnabled &&
+      json.find("\"name\":\"quote \\\" backslash \\\\ tab \\u0009\","
+                "\"cat\":\"odd\\\"name\"") == std::string::npos) {
+    std::cerr << "span name not escaped in trace.json\n";
+    ok = false;
+  }
+  std::cout << "parent events: " << events << ", processes merged: " << parts
+            << "\nwrote out/trace.json" << std::endl;
+  return ok ? h.Finish() : 1;
+}